@@ -0,0 +1,892 @@
+// aot.h
+// Translation of quad programs to C for the Compiler Theory Class
+// interpreter
+
+// "vmq --aot prog.c prog.q" writes a C translation unit for a verified
+// program.  Each quad becomes a labelled statement over an array that
+// holds the emulated memory: jumps and calls are gotos, and a return goes
+// through a switch on the quad number.  Pseudo-calls go through a hook in
+// the vmq_machine the code runs on.  The file compiles on its own into
+// either
+//
+//   a standalone program, which holds the initialized data and does its
+//   I/O with stdio:	cc -O2 -o prog prog.c
+//
+//   a shared object that vmq loads and runs in place of its own engines:
+//			cc -O2 -shared -fPIC -DVMQ_PLUGIN -o prog.so prog.c
+//			vmq --native prog.so prog.q
+//
+// As with native code from jit.h, translated code stops before any quad
+// that would raise an error.  Under vmq the threaded engine carries on
+// from that quad and reports the error as it always has; a standalone
+// program names the quad and exits.  The standalone program reads
+// numbers with scanf, which is not quite >>: a bad number reads as 0.
+
+#ifndef AOT_H
+#define AOT_H
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include "storage.h"
+#include "quad.h"
+#include "threaded.h"
+#include "block.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_DLOPEN
+#include <dlfcn.h>
+#endif
+
+using namespace std;
+
+#define AOT_ABI 1	// change when vmq_machine or the exports change
+
+// The machine translated code runs on; the generated file declares the
+// same structure.  pc is the quad the threaded engine is to continue
+// with when translated code stops.
+extern "C"
+{
+	struct vmq_machine
+	{
+		unsigned char *mem;	// emulated memory
+		unsigned short top, link;	// stack top, dynamic link
+		unsigned short gsize;	// size of global data area
+		int running;		// a '$' has been executed
+		int pc;
+		int (*pseudo) ( struct vmq_machine *m, int fn );
+		void *user;
+	};
+	typedef int (*aot_run_type) ( struct vmq_machine *m );
+}
+
+// A checksum of the quads, which the generated file carries so that vmq
+// runs it only with the program it was made from (FNV-1a)
+inline void aot_mix ( unsigned long &h, const void *p, size_t n )
+{
+	for ( size_t i = 0; i < n; ++i )
+	{
+		h ^= ((const unsigned char *)p)[i];
+		h = ( h * 16777619UL ) & 0xffffffffUL;
+	}
+}
+
+inline unsigned long aot_checksum ( const quad_list &qlist )
+{
+	unsigned long h = 2166136261UL;
+	for ( size_t i = 0; i < qlist.size(); ++i )
+	{
+		const quad_type &q = qlist[i];
+		const char op = q.op();
+		aot_mix ( h, &op, 1 );
+		const qop *o[3] = { &q.op1(), &q.op2(), &q.op3() };
+		for ( int k = 0; k < 3; ++k )
+		{
+			aot_mix ( h, &o[k]->vtype, 1 );
+			aot_mix ( h, &o[k]->adrmode, 1 );
+			// Only the member of the value in use is defined
+			if ( o[k]->vtype == 'f' )
+				aot_mix ( h, &o[k]->val.f, sizeof(float) );
+			else
+				aot_mix ( h, &o[k]->val.s, sizeof(short) );
+		}
+	}
+	return h;
+}
+
+// Write the C translation of a program.  datasize is the size of the
+// initialized part of data memory; name is that of the output file.
+class qtranslator
+{
+public:
+	qtranslator ( ostream &os, const storage_type &mem,
+		const quad_list &qlist, size_t datasize, const string &name )
+		: m_os(os), m_mem(mem), m_qlist(qlist), m_datasize(datasize),
+		  m_name(name), m_returns(false), m_cur(0) {}
+	bool go ( void );	// false, with the reason in why(), if it can't
+	const string &why ( void ) const { return m_why; }
+
+private:
+	void targets ( void );
+	void label ( size_t i, const string &text );
+	void prologue ( void );
+	void epilogue ( void );
+	void quad ( size_t i );
+	bool body ( size_t i );	// false if there is no translation
+
+	// Pieces of quad bodies.  Operands yield C expressions; a computed
+	// address is first held in a variable named t.
+	void line ( const string &s ) { m_os << "\t\t" << s << '\n'; }
+	string stop ( void ) const { return "STOP ( " + num ( m_cur ) + " );"; }
+	string go_quad ( short target ) const
+		{ return "goto q" + num ( target ) + ";"; }
+	static string num ( long n );
+	static string rel ( short s );
+	string addr ( const opval &v, int m, int width, const string &t );
+	string sval ( const opval &v, int m, const string &t );
+	string cval ( const opval &v, int m, const string &t );
+	string aval ( const opval &v, int m, const string &t );
+	string fval ( const opval &v, int m, const string &t );
+
+	ostream &m_os;
+	const storage_type &m_mem;
+	const quad_list &m_qlist;
+	vector<dquad_type> m_code;
+	size_t m_datasize;
+	string m_name;
+	vector<bool> m_target;	// quads, and the end marker, control can reach
+	bool m_returns;		// ... including any quad, by a return
+	size_t m_cur;		// quad being translated
+	string m_why;
+};
+
+inline bool qtranslator::go ( void )
+{
+	if ( m_qlist.empty() || m_qlist[0].op() != '$' )
+	{
+		m_why = "First quad must be '$'";
+		return false;
+	}
+	for ( size_t i = 0; i < m_qlist.size(); ++i )
+		if ( m_qlist[i].tron() || m_qlist[i].troff() || m_qlist[i].dump() )
+		{
+			m_why = "translated code can't trace or dump";
+			return false;
+		}
+
+	qdecoder decoder ( m_qlist, m_code );
+	decoder.go();
+	targets();
+
+	prologue();
+	for ( size_t i = 0; i < m_qlist.size(); ++i ) quad ( i );
+	epilogue();
+	return bool ( m_os );
+}
+
+inline string qtranslator::num ( long n )
+{
+	ostringstream os;
+	if ( n < 0 ) os << '(' << n << ')';
+	else os << n;
+	return os.str();
+}
+
+inline string qtranslator::rel ( short s )
+{
+	ostringstream os;
+	os << "(unsigned short)(L " << (s < 0? '-': '+') << ' '
+		<< (s < 0? -long ( s ): long ( s )) << ')';
+	return os.str();
+}
+
+// The address of an l-value operand.  A computed (indirect) address of a
+// datum wider than a byte must be even.
+inline string qtranslator::addr ( const opval &v, int m, int width,
+	const string &t )
+{
+	switch ( m )
+	{
+	case AM_IND:
+		line ( "unsigned short " + t + " = ld_a ( M, " + num ( v.a )
+			+ " );" );
+		break;
+	case AM_REL:
+		return rel ( v.s );
+	case AM_RELIND:
+		line ( "unsigned short " + t + " = ld_a ( M, " + rel ( v.s )
+			+ " );" );
+		break;
+	default:
+		return num ( v.a );
+	}
+	if ( width > 1 ) line ( "if ( " + t + " & 1 ) " + stop() );
+	return t;
+}
+
+// Operand values, formed as d_sval, d_cval, d_aval and d_fval would
+inline string qtranslator::sval ( const opval &v, int m, const string &t )
+{
+	switch ( m )
+	{
+	case AM_IMM: return num ( v.s );
+	case AM_RELIMM: return "(short)" + rel ( v.s );
+	default: return "ld_s ( M, " + addr ( v, m, 2, t ) + " )";
+	}
+}
+
+inline string qtranslator::cval ( const opval &v, int m, const string &t )
+{
+	switch ( m )
+	{
+	case AM_IMM: return "(unsigned char)" + num ( v.s );
+	case AM_RELIMM: return "(unsigned char)" + rel ( v.s );
+	default: return "M[" + addr ( v, m, 1, t ) + "]";
+	}
+}
+
+inline string qtranslator::aval ( const opval &v, int m, const string &t )
+{
+	switch ( m )
+	{
+	case AM_IMM: return num ( v.a );
+	case AM_RELIMM: return rel ( v.s );
+	default: return "ld_a ( M, " + addr ( v, m, 2, t ) + " )";
+	}
+}
+
+inline string qtranslator::fval ( const opval &v, int m, const string &t )
+{
+	if ( m == AM_IMM )
+	{
+		// The exact bits, since a decimal float might not round trip
+		unsigned int b;
+		memcpy ( &b, &v.f, sizeof(b) );
+		ostringstream os;
+		os << "fbits ( 0x" << hex << b << "u )";
+		return os.str();
+	}
+	return "ld_f ( M, " + addr ( v, m, 4, t ) + " )";
+}
+
+// Find the quads that need labels.  A return address comes from memory,
+// so with any return every quad does.
+inline void qtranslator::targets ( void )
+{
+	const size_t n = m_qlist.size();
+	m_returns = false;
+	for ( size_t i = 0; i < n; ++i )
+		if ( m_qlist[i].op() == '/' ) m_returns = true;
+	m_target.assign ( n + 1, m_returns );
+	for ( size_t i = 0; i < n; ++i )
+	{
+		const dquad_type &d = m_code[i];
+		switch ( m_qlist[i].op() )
+		{
+		case 'l': case 'L': case 'g': case 'G': case 'e': case 'E':
+			m_target[d.v3.s] = true;
+			break;
+		case 'c':
+			if ( d.v2.s >= 0 ) m_target[d.v2.s] = true;
+			break;
+		case '$': case 'j':
+			m_target[d.v1.s] = true;
+			break;
+		}
+	}
+}
+
+// Start the statement for quad i, with a label if control can reach it
+// other than by falling through
+inline void qtranslator::label ( size_t i, const string &text )
+{
+	if ( m_target[i] ) m_os << "q" << i << ":\t/* " << text << " */\n";
+	else m_os << "\t/* " << i << ": " << text << " */\n";
+}
+
+inline void qtranslator::prologue ( void )
+{
+	m_os << "/* " << m_name << ": quad program translated to C by vmq "
+		VERSION "\n"
+		" *\n"
+		" * Standalone program:\tcc -O2 -o prog " << m_name << "\n"
+		" * Plugin for vmq:\tcc -O2 -shared -fPIC -DVMQ_PLUGIN"
+		" -o prog.so " << m_name << "\n"
+		" *\t\t\tvmq --native prog.so <quadfile>\n"
+		" */\n"
+		"\n"
+		"#include <stdio.h>\n"
+		"#include <stdlib.h>\n"
+		"#include <string.h>\n"
+		"\n"
+		"struct vmq_machine\n"
+		"{\n"
+		"\tunsigned char *mem;\n"
+		"\tunsigned short top, link;\n"
+		"\tunsigned short gsize;\n"
+		"\tint running;\n"
+		"\tint pc;\n"
+		"\tint (*pseudo) ( struct vmq_machine *m, int fn );\n"
+		"\tvoid *user;\n"
+		"};\n"
+		"\n"
+		"const int vmq_aot_abi = " << AOT_ABI << ";\n"
+		"const unsigned long vmq_aot_checksum = 0x" << hex
+		<< aot_checksum ( m_qlist ) << dec << "UL;\n"
+		"\n"
+		"/* Emulated memory, in the byte order of the machine */\n"
+		"static inline short ld_s ( const unsigned char *M, unsigned a )\n"
+		"\t{ short v; memcpy ( &v, M + a, sizeof v ); return v; }\n"
+		"static inline unsigned short ld_a ( const unsigned char *M,"
+		" unsigned a )\n"
+		"\t{ unsigned short v; memcpy ( &v, M + a, sizeof v ); return v; }\n"
+		"static inline float ld_f ( const unsigned char *M, unsigned a )\n"
+		"\t{ float v; memcpy ( &v, M + a, sizeof v ); return v; }\n"
+		"static inline void st_s ( unsigned char *M, unsigned a, short v )\n"
+		"\t{ memcpy ( M + a, &v, sizeof v ); }\n"
+		"static inline void st_a ( unsigned char *M, unsigned a,"
+		" unsigned short v )\n"
+		"\t{ memcpy ( M + a, &v, sizeof v ); }\n"
+		"static inline void st_f ( unsigned char *M, unsigned a, float v )\n"
+		"\t{ memcpy ( M + a, &v, sizeof v ); }\n"
+		"static inline float fbits ( unsigned int b )\n"
+		"\t{ float f; memcpy ( &f, &b, sizeof f ); return f; }\n"
+		"\n"
+		"/* Stop before quad n has any effect */\n"
+		"#define STOP(n) do { m->pc = (n); r = 1; goto leave; } while (0)\n"
+		"\n"
+		"/* Run from quad 0.  Returns 0 on a halt, or 1 when stopped at quad"
+		" m->pc. */\n"
+		"int vmq_run ( struct vmq_machine *m )\n"
+		"{\n"
+		"\tunsigned char *const M = m->mem;\n"
+		"\tunsigned short T = m->top, L = m->link, G = m->gsize;\n"
+		"\tint running = m->running;\n";
+	if ( m_returns ) m_os << "\tunsigned target;\n";
+	// Block quads keep within data memory, which the stack starts at the
+	// top of
+	for ( size_t i = 0; i < m_qlist.size(); ++i )
+		if ( block_op ( m_qlist[i].op() ) )
+		{
+			m_os << "\tconst unsigned S = m->top;\n";
+			break;
+		}
+	m_os << "\tint r;\n"
+		"\n";
+}
+
+inline void qtranslator::epilogue ( void )
+{
+	const size_t n = m_qlist.size();
+	label ( n, "end of the program" );
+	m_os << "\tSTOP ( " << n << " );\n"
+		"\n";
+
+	if ( m_returns )
+	{
+		m_os << "ret:\n"
+			"\tswitch ( target )\n"
+			"\t{\n";
+		for ( size_t i = 0; i < n; ++i )
+			m_os << "\tcase " << i << ": goto q" << i << ";\n";
+		m_os << "\tdefault: goto q" << n << ";\n"
+			"\t}\n"
+			"\n";
+	}
+	m_os << "leave:\n"
+		"\tm->top = T;\n"
+		"\tm->link = L;\n"
+		"\tm->gsize = G;\n"
+		"\tm->running = running;\n"
+		"\treturn r;\n"
+		"}\n"
+		"\n"
+		"#ifndef VMQ_PLUGIN\n"
+		"\n"
+		"#define VMQ_MEMSIZE " << m_mem.Size() << "\n"
+		"\n"
+		"/* Initialized data */\n"
+		"static const unsigned char vmq_data[" << (m_datasize? m_datasize: 1)
+		<< "] =\n"
+		"{";
+	const unsigned char *data = (const unsigned char *)m_mem.Image();
+	for ( size_t i = 0; i < m_datasize; ++i )
+		m_os << (i % 16? " ": "\n\t") << unsigned ( data[i] )
+			<< (i + 1 < m_datasize? ",": "");
+	if ( !m_datasize ) m_os << "\n\t0";
+	m_os << "\n};\n"
+		"\n"
+		"/* Pseudo-calls; the variable is on top of the stack */\n"
+		"static int stdio_pseudo ( struct vmq_machine *m, int fn )\n"
+		"{\n"
+		"\tunsigned char *const M = m->mem;\n"
+		"\tconst unsigned short arg = ld_a ( M, m->top );\n"
+		"\tswitch ( fn )\n"
+		"\t{\n"
+		"\tcase -1:\n"
+		"\t\t{\n"
+		"\t\t\tlong x = 0;\n"
+		"\t\t\tif ( arg & 1 ) return 1;\n"
+		"\t\t\tif ( scanf ( \"%ld\", &x ) != 1 ) x = 0;\n"
+		"\t\t\tif ( x > 32767 ) x = 32767;\n"
+		"\t\t\tif ( x < -32768 ) x = -32768;\n"
+		"\t\t\tst_s ( M, arg, (short)x );\n"
+		"\t\t}\n"
+		"\t\tbreak;\n"
+		"\tcase -2:\n"
+		"\t\t{\n"
+		"\t\t\tfloat x = 0;\n"
+		"\t\t\tif ( arg & 1 ) return 1;\n"
+		"\t\t\tif ( scanf ( \"%f\", &x ) != 1 ) x = 0;\n"
+		"\t\t\tst_f ( M, arg, x );\n"
+		"\t\t}\n"
+		"\t\tbreak;\n"
+		"\tcase -3:\n"
+		"\t\t{\n"
+		"\t\t\tunsigned short a = arg;\n"
+		"\t\t\tint c;\n"
+		"\t\t\twhile ( (c = getchar()) != EOF && c != '\\n' ) M[a++] = c;\n"
+		"\t\t\tM[a++] = '\\n';\n"
+		"\t\t\tM[a] = '\\0';\n"
+		"\t\t}\n"
+		"\t\tbreak;\n"
+		"\tcase -4:\n"
+		"\t\t{\n"
+		"\t\t\tconst short n = ld_s ( M, (unsigned short)(m->top + 2) );\n"
+		"\t\t\tshort k;\n"
+		"\t\t\tif ( arg & 1 ) return 1;\n"
+		"\t\t\tfor ( k = 0; k < n; ++k )\n"
+		"\t\t\t{\n"
+		"\t\t\t\tlong x = 0;\n"
+		"\t\t\t\tif ( scanf ( \"%ld\", &x ) != 1 ) x = 0;\n"
+		"\t\t\t\tif ( x > 32767 ) x = 32767;\n"
+		"\t\t\t\tif ( x < -32768 ) x = -32768;\n"
+		"\t\t\t\tst_s ( M, (unsigned short)(arg + 2 * k), (short)x );\n"
+		"\t\t\t}\n"
+		"\t\t}\n"
+		"\t\tbreak;\n"
+		"\tcase -5:\n"
+		"\t\t{\n"
+		"\t\t\tconst short n = ld_s ( M, (unsigned short)(m->top + 2) );\n"
+		"\t\t\tshort k;\n"
+		"\t\t\tif ( arg & 1 ) return 1;\n"
+		"\t\t\tfor ( k = 0; k < n; ++k )\n"
+		"\t\t\t{\n"
+		"\t\t\t\tfloat x = 0;\n"
+		"\t\t\t\tif ( scanf ( \"%f\", &x ) != 1 ) x = 0;\n"
+		"\t\t\t\tst_f ( M, (unsigned short)(arg + 4 * k), x );\n"
+		"\t\t\t}\n"
+		"\t\t}\n"
+		"\t\tbreak;\n"
+		"\tcase -9:\n"
+		"\t\tif ( arg & 1 ) return 1;\n"
+		"\t\tprintf ( \"%d\", ld_s ( M, arg ) );\n"
+		"\t\tbreak;\n"
+		"\tcase -10:\n"
+		"\t\tif ( arg & 1 ) return 1;\n"
+		"\t\tprintf ( \"%g\", ld_f ( M, arg ) );\n"
+		"\t\tbreak;\n"
+		"\tcase -11:\n"
+		"\t\tfputs ( (const char *)M + arg, stdout );\n"
+		"\t\tbreak;\n"
+		"\tcase -12:\n"
+		"\tcase -13:\n"
+		"\t\t{\n"
+		"\t\t\tconst short n = ld_s ( M, (unsigned short)(m->top + 2) );\n"
+		"\t\t\tconst char *sep ="
+		" (const char *)M + ld_a ( M, (unsigned short)(m->top + 4) );\n"
+		"\t\t\tshort k;\n"
+		"\t\t\tif ( arg & 1 ) return 1;\n"
+		"\t\t\tfor ( k = 0; k < n; ++k )\n"
+		"\t\t\t{\n"
+		"\t\t\t\tif ( fn == -12 )\n"
+		"\t\t\t\t\tprintf ( \"%d\","
+		" ld_s ( M, (unsigned short)(arg + 2 * k) ) );\n"
+		"\t\t\t\telse\n"
+		"\t\t\t\t\tprintf ( \"%g\","
+		" ld_f ( M, (unsigned short)(arg + 4 * k) ) );\n"
+		"\t\t\t\tfputs ( sep, stdout );\n"
+		"\t\t\t}\n"
+		"\t\t}\n"
+		"\t\tbreak;\n"
+		"\tdefault:\n"
+		"\t\treturn 1;\n"
+		"\t}\n"
+		"\treturn 0;\n"
+		"}\n"
+		"\n"
+		"int main ( void )\n"
+		"{\n"
+		"\tstruct vmq_machine m;\n"
+		"\t/* Room for any 16-bit address */\n"
+		"\tm.mem = calloc ( 0x10000 + sizeof(float), 1 );\n"
+		"\tif ( !m.mem ) return 10;\n"
+		"\tmemcpy ( m.mem, vmq_data, " << m_datasize << " );\n"
+		"\tm.top = m.link = VMQ_MEMSIZE;\n"
+		"\tm.gsize = 0;\n"
+		"\tm.running = 0;\n"
+		"\tm.pc = 0;\n"
+		"\tm.pseudo = stdio_pseudo;\n"
+		"\tm.user = 0;\n"
+		"\tif ( vmq_run ( &m ) )\n"
+		"\t{\n"
+		"\t\tfflush ( stdout );\n"
+		"\t\tfprintf ( stderr, \"Quad address %d: run-time error: STOP"
+		" (run the program under vmq for details)\\n\", m.pc );\n"
+		"\t\treturn 10;\n"
+		"\t}\n"
+		"\treturn 0;\n"
+		"}\n"
+		"\n"
+		"#endif /* VMQ_PLUGIN */\n";
+}
+
+inline void qtranslator::quad ( size_t i )
+{
+	// The quad as vmq lists it, for reading the C
+	ostringstream text;
+	text << m_qlist[i];
+	string s = text.str();
+	for ( size_t k; (k = s.find ( "*/" )) != string::npos; ) s[k+1] = ' ';
+
+	m_cur = i;
+	label ( i, s );
+	m_os << "\t{\n";
+	if ( !body ( i ) ) line ( stop() );
+	m_os << "\t}\n";
+}
+
+// Statements for quad i, stopping before any effect where the threaded
+// engine would raise an error
+inline bool qtranslator::body ( size_t i )
+{
+	const dquad_type &d = m_code[i];
+	const char op = m_qlist[i].op();
+
+	switch ( op )
+	{
+	// 3 address quads
+	case 'a': case 's': case 'm': case 'd': case 'r': case '|': case '&':
+	{
+		if ( d.m3 >= AM_LVALS ) return false;
+		const string dst = addr ( d.v3, d.m3, 2, "t3" );
+		line ( "short x = " + sval ( d.v1, d.m1, "t1" ) + ";" );
+		line ( "short y = " + sval ( d.v2, d.m2, "t2" ) + ";" );
+		if ( op == 'd' || op == 'r' ) line ( "if ( y == 0 ) " + stop() );
+		const char *c = op == 'a'? "+": op == 's'? "-": op == 'm'? "*":
+			op == 'd'? "/": op == 'r'? "%": op == '|'? "|": "&";
+		line ( "st_s ( M, " + dst + ", (short)(x " + c + " y) );" );
+		return true;
+	}
+	case 'A': case 'S': case 'M': case 'D':
+	{
+		if ( d.m1 >= AM_FLOATS || d.m2 >= AM_FLOATS || d.m3 >= AM_LVALS )
+			return false;
+		const string dst = addr ( d.v3, d.m3, 4, "t3" );
+		line ( "float x = " + fval ( d.v1, d.m1, "t1" ) + ";" );
+		line ( "float y = " + fval ( d.v2, d.m2, "t2" ) + ";" );
+		const char *c = op == 'A'? "+": op == 'S'? "-": op == 'M'? "*": "/";
+		line ( "st_f ( M, " + dst + ", x " + c + " y );" );
+		return true;
+	}
+
+	// Conditional branches
+	case 'l': case 'g': case 'e':
+	{
+		line ( "short x = " + sval ( d.v1, d.m1, "t1" ) + ";" );
+		line ( "short y = " + sval ( d.v2, d.m2, "t2" ) + ";" );
+		const char *c = op == 'l'? "<": op == 'g'? ">": "==";
+		line ( string ( "if ( x " ) + c + " y ) " + go_quad ( d.v3.s ) );
+		return true;
+	}
+	case 'L': case 'G': case 'E':
+	{
+		if ( d.m1 >= AM_FLOATS || d.m2 >= AM_FLOATS ) return false;
+		line ( "float x = " + fval ( d.v1, d.m1, "t1" ) + ";" );
+		line ( "float y = " + fval ( d.v2, d.m2, "t2" ) + ";" );
+		const char *c = op == 'L'? "<": op == 'G'? ">": "==";
+		line ( string ( "if ( x " ) + c + " y ) " + go_quad ( d.v3.s ) );
+		return true;
+	}
+
+	// 2 address quads
+	case 'i': case '~': case 'n':
+	{
+		if ( d.m2 >= AM_LVALS ) return false;
+		const string dst = addr ( d.v2, d.m2, 2, "t2" );
+		line ( "short x = " + sval ( d.v1, d.m1, "t1" ) + ";" );
+		const char *e = op == 'i'? "x": op == '~'? "(short)~x": "(short)-x";
+		line ( "st_s ( M, " + dst + ", " + e + " );" );
+		return true;
+	}
+	case 'I': case 'N':
+	{
+		if ( d.m1 >= AM_FLOATS || d.m2 >= AM_LVALS ) return false;
+		const string dst = addr ( d.v2, d.m2, 4, "t2" );
+		line ( "float x = " + fval ( d.v1, d.m1, "t1" ) + ";" );
+		line ( "st_f ( M, " + dst + ", " + (op == 'I'? "x": "-x") + " );" );
+		return true;
+	}
+	case '=':
+	{
+		if ( d.m2 >= AM_LVALS ) return false;
+		const string dst = addr ( d.v2, d.m2, 1, "t2" );
+		line ( "M[" + dst + "] = " + cval ( d.v1, d.m1, "t1" ) + ";" );
+		return true;
+	}
+	case 'F':
+	{
+		if ( d.m2 >= AM_LVALS ) return false;
+		const string dst = addr ( d.v2, d.m2, 4, "t2" );
+		line ( "short x = " + sval ( d.v1, d.m1, "t1" ) + ";" );
+		line ( "st_f ( M, " + dst + ", (float)x );" );
+		return true;
+	}
+	case 'f':
+	{
+		if ( d.m1 >= AM_FLOATS || d.m2 >= AM_LVALS ) return false;
+		const string dst = addr ( d.v2, d.m2, 2, "t2" );
+		if ( d.m1 == AM_IMM )
+		{
+			// Converted here, as the engines convert at run time; the C
+			// compiler might fold an out of range value differently
+			line ( "st_s ( M, " + dst + ", " + num ( short ( d.v1.f ) )
+				+ " );" );
+			return true;
+		}
+		line ( "float x = " + fval ( d.v1, d.m1, "t1" ) + ";" );
+		line ( "st_s ( M, " + dst + ", (short)x );" );
+		return true;
+	}
+
+	// Function call
+	case 'c':
+		if ( d.v2.s < 0 )
+		{
+			switch ( d.v2.s )
+			{
+			case -1: case -2: case -3: case -4: case -5:
+			case -9: case -10: case -11: case -12: case -13:
+				break;
+			default:
+				return false;
+			}
+			line ( "m->top = T;" );
+			line ( "m->link = L;" );
+			line ( "if ( m->pseudo ( m, " + num ( d.v2.s ) + " ) ) "
+				+ stop() );
+			return true;
+		}
+		line ( "unsigned short a = " + aval ( d.v1, d.m1, "t1" ) + ";" );
+		line ( "T = T - 2;" );
+		line ( "st_a ( M, T, a );" );
+		line ( "T = T - 2;" );
+		line ( "st_a ( M, T, " + num ( i + 1 ) + " );" );
+		line ( go_quad ( d.v2.s ) );
+		return true;
+
+	// Push parameter, checking for stack overflow
+	case 'p':
+		line ( "if ( T - 2 < G ) " + stop() );
+		line ( "unsigned short a = " + aval ( d.v1, d.m1, "t1" ) + ";" );
+		line ( "T = T - 2;" );
+		line ( "st_a ( M, T, a );" );
+		return true;
+	case 'P':
+		if ( d.m1 >= AM_FLOATS ) return false;
+		line ( "if ( T - 4 < G ) " + stop() );
+		line ( "float x = " + fval ( d.v1, d.m1, "t1" ) + ";" );
+		line ( "T = T - 4;" );
+		line ( "st_f ( M, T, x );" );
+		return true;
+
+	// Create stack frame
+	case '#':
+		line ( "T = T - 2;" );
+		line ( "st_a ( M, T, L );" );
+		line ( "L = T;" );
+		line ( "T = T - " + num ( d.v1.s ) + ";" );
+		return true;
+
+	// Pop runtime stack
+	case '^':
+		if ( d.v1.s & 1 ) return false;
+		line ( "T = T + " + num ( d.v1.s ) + ";" );
+		return true;
+
+	// Return: the restored link must be even
+	case '/':
+		line ( "unsigned short link = ld_a ( M, L );" );
+		line ( "if ( link & 1 ) " + stop() );
+		line ( "target = ld_a ( M, " + rel ( 2 ) + " );" );
+		line ( "T = L + 6;" );
+		line ( "L = link;" );
+		line ( "goto ret;" );
+		return true;
+
+	case '$':
+		line ( "if ( running ) " + stop() );
+		line ( "running = 1;" );
+		line ( "G = " + num ( adr_type ( d.v2.s ) ) + ";" );
+		line ( go_quad ( d.v1.s ) );
+		return true;
+	case 'j':
+		line ( go_quad ( d.v1.s ) );
+		return true;
+	case 'h':
+		line ( "r = 0;" );
+		line ( "goto leave;" );
+		return true;
+	case ';':
+		line ( ";" );
+		return true;
+
+	// Block and vector quads (block.h), as loops for the C compiler to
+	// vectorize
+	case 'b': case 'w': case 'W': case 'v': case 'V': case 'u': case 'U':
+	case 't': case 'T':
+	{
+		const bool fill = op == 'w' || op == 'W';
+		if ( d.m3 >= AM_LVALS || d.m1 >= (op == 'w'? AM_ALL:
+				op == 'W'? AM_FLOATS: AM_LVALS) )
+			return false;
+		const size_t w = block_width ( op );
+		line ( "unsigned to = " + addr ( d.v3, d.m3, 1, "t3" ) + ";" );
+		if ( op == 'w' )
+			line ( "short x = " + sval ( d.v1, d.m1, "t1" ) + ";" );
+		else if ( op == 'W' )
+			line ( "float x = " + fval ( d.v1, d.m1, "t1" ) + ";" );
+		else
+			line ( "unsigned from = " + addr ( d.v1, d.m1, 1, "t1" ) + ";" );
+		line ( "short n = " + sval ( d.v2, d.m2, "t2" ) + ";" );
+		line ( "if ( n < 0 ) " + stop() );
+		line ( "unsigned bytes = (unsigned)n * " + num ( w ) + ";" );
+		// An empty block is not checked
+		string bad = "to + bytes > S";
+		if ( !fill ) bad += " || from + bytes > S";
+		if ( w > 1 ) bad = ( fill? "(to & 1)": "((to | from) & 1)" )
+			+ string ( " || " ) + bad;
+		line ( "if ( bytes && ( " + bad + " ) ) " + stop() );
+		const char *c = op == 'v' || op == 'V'? "+":
+			op == 'u' || op == 'U'? "-": "*";
+		switch ( op )
+		{
+		case 'b':
+			line ( "memmove ( M + to, M + from, bytes );" );
+			break;
+		case 'w':
+			line ( "for ( unsigned k = 0; k < bytes; k += 2 )"
+				" st_s ( M, to + k, x );" );
+			break;
+		case 'W':
+			line ( "for ( unsigned k = 0; k < bytes; k += 4 )"
+				" st_f ( M, to + k, x );" );
+			break;
+		case 'v': case 'u': case 't':
+			line ( "for ( unsigned k = 0; k < bytes; k += 2 )" );
+			line ( string ( "\tst_s ( M, to + k, (short)(ld_s ( M, to + k ) " )
+				+ c + " ld_s ( M, from + k )) );" );
+			break;
+		default:
+			line ( "for ( unsigned k = 0; k < bytes; k += 4 )" );
+			line ( string ( "\tst_f ( M, to + k, ld_f ( M, to + k ) " )
+				+ c + " ld_f ( M, from + k ) );" );
+			break;
+		}
+		return true;
+	}
+	}
+
+	return false;
+}
+
+// A shared object compiled from the C for a program.  run() runs it from
+// quad 0 on mem, and returns 0 on a halt, or nonzero when the threaded
+// engine is to continue with the state in regs().
+class aot_module
+{
+public:
+	aot_module ( void ): m_handle(0), m_run(0) {}
+	~aot_module ();
+	// Load fname, made from qlist; false, with the reason in why(), if
+	// it can't be used
+	bool open ( const char *fname, const quad_list &qlist );
+	const string &why ( void ) const { return m_why; }
+
+	int run ( storage_type &mem );
+	const vmq_machine &regs ( void ) const { return m_regs; }
+
+private:
+	aot_module ( const aot_module & );		// not copyable
+	void operator = ( const aot_module & );
+
+	static int pseudo ( vmq_machine *m, int fn );
+
+	void *m_handle;
+	aot_run_type m_run;
+	vmq_machine m_regs;
+	string m_why;
+};
+
+inline aot_module::~aot_module ()
+{
+#ifdef HAVE_DLOPEN
+	if ( m_handle ) dlclose ( m_handle );
+#endif
+}
+
+inline bool aot_module::open ( const char *fname,
+	const quad_list &qlist )
+{
+#ifdef HAVE_DLOPEN
+	// A name without a '/' would be searched for, not opened
+	const string path = strchr ( fname, '/' )? fname: string ( "./" ) + fname;
+	m_handle = dlopen ( path.c_str(), RTLD_NOW | RTLD_LOCAL );
+	if ( !m_handle )
+	{
+		m_why = dlerror();
+		return false;
+	}
+	const int *abi = (const int *)dlsym ( m_handle, "vmq_aot_abi" );
+	const unsigned long *sum =
+		(const unsigned long *)dlsym ( m_handle, "vmq_aot_checksum" );
+	m_run = (aot_run_type)dlsym ( m_handle, "vmq_run" );
+	if ( !abi || !sum || !m_run )
+		m_why = "not compiled from the output of vmq --aot";
+	else if ( *abi != AOT_ABI )
+		m_why = "made by another version of vmq";
+	else if ( *sum != aot_checksum ( qlist ) )
+		m_why = "made from another program";
+	else
+		return true;
+	dlclose ( m_handle );
+	m_handle = 0;
+	m_run = 0;
+	return false;
+#else
+	m_why = "shared objects can't be loaded on this system";
+	return false;
+#endif
+}
+
+inline int aot_module::run ( storage_type &mem )
+{
+	m_regs.mem = (unsigned char *)mem.Image();
+	m_regs.top = mem.STop();
+	m_regs.link = mem.DLink();
+	m_regs.gsize = 0;
+	m_regs.running = 0;
+	m_regs.pc = 0;
+	m_regs.pseudo = pseudo;
+	m_regs.user = &mem;
+	const int r = m_run ( &m_regs );
+	*mem.TopReg() = m_regs.top;
+	*mem.LinkReg() = m_regs.link;
+	return r;
+}
+
+// Pseudo-calls from translated code, done as the engines do them
+inline int aot_module::pseudo ( vmq_machine *m, int fn )
+{
+	storage_type *mem = (storage_type *)m->user;
+	*mem->TopReg() = m->top;
+	*mem->LinkReg() = m->link;
+	switch ( fn )
+	{
+	case -1: return native_pseudo<-1> ( mem );
+	case -2: return native_pseudo<-2> ( mem );
+	case -3: return native_pseudo<-3> ( mem );
+	case -4: return native_pseudo<-4> ( mem );
+	case -5: return native_pseudo<-5> ( mem );
+	case -9: return native_pseudo<-9> ( mem );
+	case -10: return native_pseudo<-10> ( mem );
+	case -11: return native_pseudo<-11> ( mem );
+	case -12: return native_pseudo<-12> ( mem );
+	case -13: return native_pseudo<-13> ( mem );
+	}
+	return 1;
+}
+
+#endif // AOT_H
@@ -0,0 +1,186 @@
+// batch.h
+// Batch runs for the Compiler Theory Class interpreter
+
+// A qbatch runs one loaded program once for each input file named in a
+// list, one name to a line, on a pool of threads.  Each run reads its
+// input file and writes its output, with any traces and dumps, to the
+// same name plus ".out".  Its error messages go to standard error
+// together, after the name of its input.
+//
+// The quads are decoded once and shared; each thread has its own data
+// memory, its own interpreter (and native code), and its own program I/O
+// (see output.h, input.h).  Before the runs, the program is run once to
+// its first read, and every run starts from the snapshot taken there
+// (see snapshot.h), unless one was loaded already.
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#include "storage.h"
+#include "quad.h"
+#include "output.h"
+#include "input.h"
+#include "threaded.h"
+#include "mapfile.h"
+#include "interp.h"
+#include "snapshot.h"
+
+using namespace std;
+
+class qbatch
+{
+public:
+	qbatch ( const storage_type &mem, const quad_list &qlist,
+		bool use_switch, bool use_jit, bool use_regs )
+		: m_mem(mem), m_qlist(qlist), m_switch(use_switch),
+		  m_jit(use_jit), m_regs(use_regs), m_next(0), m_failed(0),
+		  m_level(0) {}
+	bool open ( const char *listname );	// false, with errno set, on failure
+
+	// Run every input on nthreads threads; returns the level of the
+	// worst error
+	int go ( unsigned nthreads );
+	size_t runs ( void ) const { return m_inputs.size(); }
+	size_t failed ( void ) const { return m_failed; }	// with errors
+	qsnapshot &snapshot ( void ) { return m_snap; }
+
+private:
+	void worker ( void );
+	void take_snapshot ( void );
+	static void write ( void *os, const char *p, size_t n )
+		{ ((ostream *)os)->write ( p, n ); }
+	static void discard ( void *, const char *, size_t ) {}
+
+	const storage_type &m_mem;
+	const quad_list &m_qlist;
+	bool m_switch, m_jit, m_regs;
+	vector<string> m_inputs;
+	vector<dquad_type> m_code;	// shared by the threads
+	qsnapshot m_snap;		// ... and where they start
+	atomic<size_t> m_next;		// input to run next
+	mutex m_lock;			// for the rest, and standard error
+	size_t m_failed;
+	int m_level;
+};
+
+inline bool qbatch::open ( const char *listname )
+{
+	mapped_file list;
+	if ( !list.open ( listname ) ) return false;
+	const char *p = list.data(), *end = p + list.size();
+	while ( p < end )
+	{
+		const char *eol = (const char *)memchr ( p, '\n', end - p );
+		if ( !eol ) eol = end;
+		const char *e = eol;
+		while ( e > p && isspace ( (unsigned char)e[-1] ) ) --e;
+		while ( p < e && isspace ( (unsigned char)*p ) ) ++p;
+		if ( p < e ) m_inputs.push_back ( string ( p, e ) );
+		p = eol + 1;
+	}
+	return true;
+}
+
+inline int qbatch::go ( unsigned nthreads )
+{
+	if ( !m_switch )
+	{
+		qdecoder decoder ( m_qlist, m_code );
+		decoder.go();
+	}
+	if ( !m_snap.taken() ) take_snapshot();
+	if ( nthreads > m_inputs.size() ) nthreads = m_inputs.size();
+	vector<thread> pool;
+	for ( unsigned k = 1; k < nthreads; ++k )
+		pool.push_back ( thread ( &qbatch::worker, this ) );
+	worker();
+	for ( size_t k = 0; k < pool.size(); ++k ) pool[k].join();
+	return m_level;
+}
+
+// Run to the first read.  A program that stops before it reads
+// anything leaves no snapshot; each run then goes from the start, and
+// reports the errors.
+inline void qbatch::take_snapshot ( void )
+{
+	storage_type mem ( m_mem.Size() );
+	mem.Copy ( m_mem );
+	ostringstream none;
+	interpreter machine ( mem, m_qlist, m_switch, m_jit, 0, m_regs, 0,
+		none, none );
+	if ( !m_switch ) machine.share ( m_code );
+	qout.sink ( discard, 0 );
+	machine.snapshot ( m_snap );
+	qout.sink ( 0, 0 );
+}
+
+// Take inputs from the list until there are none left
+inline void qbatch::worker ( void )
+{
+	storage_type mem ( m_mem.Size() );
+	qout_streambuf trace;
+	ostream out ( &trace );
+	ostringstream err;
+	interpreter machine ( mem, m_qlist, m_switch, m_jit, 0, m_regs, 0,
+		out, err );
+	if ( !m_switch ) machine.share ( m_code );
+
+	for ( size_t i; (i = m_next++) < m_inputs.size(); )
+	{
+		const string &input = m_inputs[i];
+		const string output = input + ".out";
+		int level = 0;
+		err.str ( "" );
+		if ( !qin.open ( input.c_str() ) )
+		{
+			err << "Can't open file " << input << ": " << strerror(errno)
+				<< endl;
+			level = ERR_ERROR;
+		}
+		else
+		{
+			ofstream os ( output.c_str(), ios::binary );
+			if ( !os )
+			{
+				err << "Can't open file " << output << ": "
+					<< strerror(errno) << endl;
+				level = ERR_ERROR;
+			}
+			else
+			{
+				qout.sink ( write, &os );
+				if ( m_snap.taken() )
+					level = machine.go ( m_snap );
+				else
+				{
+					mem.Copy ( m_mem );
+					level = machine.go();
+				}
+				qout.sink ( 0, 0 );
+				os.close();
+				if ( !os )
+				{
+					err << "Can't write file " << output << endl;
+					level = max ( level, int ( ERR_ERROR ) );
+				}
+			}
+		}
+
+		lock_guard<mutex> hold ( m_lock );
+		if ( level > ERR_WARN ) ++m_failed;
+		if ( level > m_level ) m_level = level;
+		if ( !err.str().empty() ) cerr << input << ":" << err.str();
+	}
+}
+
+#endif // BATCH_H
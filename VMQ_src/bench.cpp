@@ -0,0 +1,338 @@
+// bench.cpp
+// Microbenchmarks for the Virtual Quadruple Machine
+
+// vmq-bench makes a small quad program for each kind of quad under each
+// addressing mode its operands can take, runs it on each engine, and
+// reports the time per quad run.  A program repeats the quad under test
+// COPIES times in a loop: all it runs is that quad, its loop (an s and a
+// g quad for each time round) and a short prologue.  Each program runs
+// untimed a few times first, so that the engine has decoded it (and made
+// native code), and then is timed a few times more; the best time and
+// the median are reported.  Run it before and after a change to the
+// interpreter, on a quiet machine, to see what the change did.
+
+#define VERSION "2.04"	// as vmq.cpp
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <cstring>
+#include <cstdlib>
+
+#include "storage.h"
+#include "quad.h"
+#include "output.h"
+#include "input.h"
+#include "verify.h"
+#include "loader.h"
+#include "interp.h"
+
+using namespace std;
+
+// Output written by the program, and input it reads (none, here)
+thread_local out_buffer qout;
+thread_local in_scanner qin;
+
+#define COPIES 32	// of the quad under test in each loop
+
+// Data memory of the programs: the variables the quads work on, each in
+// a slot of 4 bytes (so an integer or an address of either machine fits),
+// then a pointer to each, for indirect operands.  Main's frame holds a
+// copy of all of it, for base-relative operands: the slot at global
+// address a is at a - FRAME in the frame.
+#define B_COUNT 0	// the loop counter
+#define B_X 4		// integers: operands and result
+#define B_Y 8
+#define B_Z 12
+#define B_FX 16		// floats
+#define B_FY 20
+#define B_FZ 24
+#define B_CX 28		// characters
+#define B_CZ 29
+#define B_PTR 32	// pointers to the variables, in the order above
+#define FRAME 64	// global data area, and main's frame
+
+// A kind of quad to time
+struct family_type
+{
+	const char *name;	// as reported
+	char type;		// of its operands: 's' int, 'f' float, 'c' char
+	const char *modes;	// addressing modes of its operands ("-" for
+				// a quad with none)
+};
+
+static const family_type families[] =
+{
+	{ ";", 's', "-" },		// the loop and dispatch alone
+	{ "a", 's', " @#_NM" },
+	{ "m", 's', " @#_NM" },
+	{ "d", 's', " @#_NM" },
+	{ "A", 'f', " @#_N" },		// #/ is never a float
+	{ "D", 'f', " @#_N" },
+	{ "i", 's', " @#_NM" },
+	{ "=", 'c', " @#_NM" },
+	{ "l", 's', " @#_NM" },		// taken
+	{ "g", 's', " @#_NM" },		// not taken
+	{ "j", 's', "-" },
+	{ "p^", 's', " @#_NM" },	// push and pop
+	{ "c#/", 's', " @#_NM" },	// call, frame and return
+};
+
+static const char *mode_name ( char mode )
+{
+	switch ( mode )
+	{
+	case ' ': return "direct";
+	case '@': return "indirect";
+	case '#': return "immediate";
+	case '_': return "relative";
+	case 'N': return "rel-indirect";
+	case 'M': return "rel-immediate";
+	}
+	return "-";
+}
+
+// Where the pointer to the variable at a lies
+static int pointer ( int a )
+{
+	static const int vars[] = { B_X, B_Y, B_Z, B_FX, B_FY, B_FZ, B_CX, B_CZ };
+	for ( size_t k = 0; k < sizeof(vars) / sizeof(vars[0]); ++k )
+		if ( vars[k] == a ) return B_PTR + 4 * k;
+	return 0;
+}
+
+// The text of an operand for the variable at a, in the given mode; an
+// immediate operand is imm instead.  A destination can't be immediate,
+// so it is direct (or relative) then.
+static string operand ( int a, char mode, const string &imm, bool dst )
+{
+	ostringstream os;
+	if ( dst && mode == '#' ) mode = ' ';
+	if ( dst && mode == 'M' ) mode = '_';
+	switch ( mode )
+	{
+	case ' ': os << a; break;
+	case '@': os << '@' << pointer ( a ); break;
+	case '#': os << '#' << imm; break;
+	case '_': os << '/' << a - FRAME; break;
+	case 'N': os << "@/" << pointer ( a ) - FRAME; break;
+	case 'M': os << "#/" << a - FRAME; break;
+	}
+	return os.str();
+}
+
+// A program that times the family under the mode, and how many quads it
+// runs in all
+static string program ( const family_type &f, char mode, int loops,
+	long &run )
+{
+	const bool flt = f.type == 'f';
+	const int x = flt? B_FX: f.type == 'c'? B_CX: B_X;
+	const int y = flt? B_FY: B_Y;
+	const int z = flt? B_FZ: f.type == 'c'? B_CZ: B_Z;
+	const string op1 = operand ( x, mode, flt? "1.5": "3", false );
+	const string op2 = operand ( y, mode, flt? "2.5": "5", false );
+	const string dst = operand ( z, mode, "", true );
+	const string adr = operand ( z, mode, "12", false );
+
+	ostringstream os;
+	os << B_X << "\t3\n" << B_Y << "\t5\n" << B_FX << "\t1.5\n"
+		<< B_FY << "\t2.5\n" << B_CX << "\t\"A\"\n";
+	for ( int k = 0; k < 8; ++k )
+	{
+		static const int vars[] = { B_X, B_Y, B_Z, B_FX, B_FY, B_FZ,
+			B_CX, B_CZ };
+		os << B_PTR + 4 * k << '\t' << vars[k] << '\n';
+	}
+
+	// Quad 0 starts main, which copies the globals into its frame
+	os << "$ 1 " << FRAME << '\n';
+	os << "# " << FRAME << '\n';
+	os << "i " << B_X << " /" << B_X - FRAME << '\n';
+	os << "i " << B_Y << " /" << B_Y - FRAME << '\n';
+	os << "i " << B_Z << " /" << B_Z - FRAME << '\n';
+	os << "I " << B_FX << " /" << B_FX - FRAME << '\n';
+	os << "I " << B_FY << " /" << B_FY - FRAME << '\n';
+	os << "I " << B_FZ << " /" << B_FZ - FRAME << '\n';
+	os << "= " << B_CX << " /" << B_CX - FRAME << '\n';
+	os << "= " << B_CZ << " /" << B_CZ - FRAME << '\n';
+	for ( int k = 0; k < 8; ++k )
+		os << "i " << B_PTR + 4 * k << " /" << B_PTR + 4 * k - FRAME
+			<< '\n';
+	os << "i #" << loops << ' ' << B_COUNT << '\n';
+	const int loop = 19;	// the quad the loop starts at
+	const int func = loop + COPIES * (f.name == string ( "p^" )? 2: 1)
+		+ 3;		// and the function c calls
+
+	int q = loop, each = 0;
+	for ( int k = 0; k < COPIES; ++k )
+	{
+		const string n = f.name;
+		if ( n == ";" )
+			os << ";\n", ++q, ++each;
+		else if ( n == "j" )
+			os << "j " << q + 1 << '\n', ++q, ++each;
+		else if ( n == "l" || n == "g" )
+			os << n << ' ' << op1 << ' ' << op2 << ' ' << q + 1 << '\n',
+				++q, ++each;
+		else if ( n == "i" || n == "=" )
+			os << n << ' ' << op1 << ' ' << dst << '\n', ++q, ++each;
+		else if ( n == "p^" )
+			os << "p " << adr << "\n^ " << sizeof(adr_type) << '\n',
+				q += 2, each += 2;
+		else if ( n == "c#/" )
+			os << "c " << adr << ' ' << func << '\n', ++q, each += 3;
+		else
+			os << n << ' ' << op1 << ' ' << op2 << ' ' << dst << '\n',
+				++q, ++each;
+	}
+	os << "s " << B_COUNT << " #1 " << B_COUNT << '\n';
+	os << "g " << B_COUNT << " #0 " << loop << '\n';
+	os << "h\n";
+	os << "# 0\n/\n";
+
+	run = loop + long ( loops ) * (each + 2) + 1;
+	return os.str();
+}
+
+// The engines, as vmq runs them
+struct engine_type
+{
+	const char *name;
+	bool use_switch, use_jit;
+};
+
+static const engine_type engines[] =
+{
+	{ "switch", true, false },
+	{ "threaded", false, false },
+	{ "jit", false, true },
+};
+#define ENGINES int ( sizeof(engines) / sizeof(engines[0]) )
+
+// Time the program on the engine: nanoseconds per quad, the best and the
+// median of reps runs after warmup untimed ones; false if it failed
+static bool measure ( const storage_type &loaded, const quad_list &qlist,
+	const engine_type &e, long run, int warmup, int reps, double &best,
+	double &median )
+{
+	storage_type mem ( loaded.Size() );
+	ostringstream none;
+	interpreter machine ( mem, qlist, e.use_switch, e.use_jit, 0, true, 0,
+		none, none );
+	vector<double> ns;
+	for ( int i = 0; i < warmup + reps; ++i )
+	{
+		mem.Copy ( loaded );
+		const chrono::steady_clock::time_point t0 =
+			chrono::steady_clock::now();
+		const int level = machine.go();
+		const chrono::steady_clock::time_point t1 =
+			chrono::steady_clock::now();
+		if ( level > ERR_WARN ) return false;
+		if ( i >= warmup )
+			ns.push_back ( chrono::duration<double, nano> ( t1 - t0 ).count()
+				/ run );
+	}
+	sort ( ns.begin(), ns.end() );
+	best = ns.front();
+	median = ns[ns.size() / 2];
+	return true;
+}
+
+static void usage ( const char *prog )
+{
+	cerr << "Usage: " << prog << " [-n <loops>] [-r <runs>] [-w <warmups>]"
+		" [--show] [<quad>...]" << endl;
+	exit ( 10 );
+}
+
+int main ( int argc, char *argv[] )
+{
+	int loops = 20000;	// times round each program's loop
+	int reps = 7;		// timed runs of each program
+	int warmup = 2;		// ... after these
+	bool show = false;	// write the programs, don't run them
+	vector<string> only;	// the families to time, if not all
+	for ( int i = 1; i < argc; ++i )
+	{
+		if ( strcmp ( argv[i], "-n" ) == 0 && i + 1 < argc
+			&& atol ( argv[i+1] ) > 0
+			&& atol ( argv[i+1] ) <= numeric_limits<word_type>::max() )
+			loops = atol ( argv[++i] );
+		else if ( strcmp ( argv[i], "-r" ) == 0 && i + 1 < argc
+			&& atoi ( argv[i+1] ) > 0 )
+			reps = atoi ( argv[++i] );
+		else if ( strcmp ( argv[i], "-w" ) == 0 && i + 1 < argc
+			&& atoi ( argv[i+1] ) >= 0 )
+			warmup = atoi ( argv[++i] );
+		else if ( strcmp ( argv[i], "--show" ) == 0 )
+			show = true;
+		else if ( argv[i][0] == '-' && argv[i][1] )
+			usage ( argv[0] );
+		else
+			only.push_back ( argv[i] );
+	}
+
+	if ( !show )
+	{
+		cout << "vmq-bench " << VERSION << ": ns per quad, best (median) of "
+			<< reps << " runs after " << warmup << ", " << COPIES
+			<< " quads x " << loops << " loops" << endl;
+		cout << left << setw(5) << "quad" << setw(14) << "mode";
+		for ( int k = 0; k < ENGINES; ++k )
+			cout << setw(16) << engines[k].name;
+		cout << right << endl;
+	}
+
+	int level = 0;
+	for ( size_t i = 0; i < sizeof(families) / sizeof(families[0]); ++i )
+	{
+		const family_type &f = families[i];
+		if ( !only.empty()
+			&& find ( only.begin(), only.end(), f.name ) == only.end() )
+			continue;
+		for ( const char *m = f.modes; *m; ++m )
+		{
+			long run;
+			const string text = program ( f, *m, loops, run );
+			if ( show )
+			{
+				cout << "; " << f.name << ' ' << mode_name ( *m ) << '\n'
+					<< text;
+				continue;
+			}
+
+			storage_type mem ( MEM_DEFAULT );
+			quad_list qlist;
+			ostringstream err;
+			qfreader loader ( text.data(), text.size(), mem, qlist, err );
+			const bool verified = loader.go() <= ERR_WARN
+				&& qverifier ( qlist, mem, err ).go();
+			cout << left << setw(5) << f.name << setw(14) << mode_name ( *m )
+				<< right << fixed << setprecision(2);
+			for ( int k = 0; k < ENGINES; ++k )
+			{
+				double best, median;
+				ostringstream cell;
+				// Only a verified program runs on the faster engines
+				if ( (verified || engines[k].use_switch)
+					&& measure ( mem, qlist, engines[k], run, warmup, reps,
+						best, median ) )
+					cell << fixed << setprecision(2) << best << " ("
+						<< median << ")";
+				else
+					cell << "-", level = 10;
+				cout << left << setw(16) << cell.str() << right;
+			}
+			cout << endl;
+			if ( !err.str().empty() ) cerr << err.str();
+		}
+	}
+	return level;
+}
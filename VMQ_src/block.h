@@ -0,0 +1,124 @@
+// block.h
+// Block memory and vector quads for the Compiler Theory Class interpreter
+
+// These quads work on blocks of memory: n elements from the address an
+// operand names, as an l-value names the first.  The second operand is
+// n, an int r-value; the third is the destination block.
+//
+//	b from n to	copy n bytes from block from to block to, as if
+//			through a buffer between, so the blocks may overlap
+//	w x n to	store the int x in each of n ints of block to
+//	W x n to	store the float x in each of n floats of block to
+//	v from n to	add each of n ints of block from to the int of block
+//	V from n to	to in the same place; V for floats
+//	u from n to	subtract likewise
+//	U from n to
+//	t from n to	multiply likewise
+//	T from n to
+//
+// Elements of the element-wise quads are taken in order of address, so
+// blocks that overlap in part see what earlier elements wrote.  Int and
+// float blocks must start at an even address, and every block must lie
+// wholly in data memory; n may be 0, which does nothing and checks
+// nothing, but not negative.  All the checks are made before anything is
+// written, so a quad that fails has no effect.
+//
+// Each engine reads the operands as it reads any others, and calls the
+// routines below to do the work; they are written as simple loops over
+// the host's memory, which the compiler can vectorize.
+
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <cstring>
+#include <stdexcept>
+#include "storage.h"
+
+using namespace std;
+
+// Is op a block or vector quad?
+inline bool block_op ( char op )
+{
+	switch ( op )
+	{
+	case 'b': case 'w': case 'W': case 'v': case 'V': case 'u': case 'U':
+	case 't': case 'T':
+		return true;
+	}
+	return false;
+}
+
+// Bytes of an element of the blocks of quad op
+inline size_t block_width ( char op )
+{
+	if ( op == 'b' ) return 1;
+	return op >= 'A' && op <= 'Z'? sizeof(float): sizeof(word_type);
+}
+
+// The bytes n elements of width bytes take; 0 if there are none
+inline size_t block_bytes ( word_type n, size_t width )
+{
+	if ( n < 0 ) throw runtime_error ( "Negative block length" );
+	return size_t ( n ) * width;
+}
+
+inline void block_move ( storage_type &mem, adr_type from, word_type n,
+	adr_type to )
+{
+	const size_t bytes = block_bytes ( n, 1 );
+	if ( !bytes ) return;
+	const char *s = mem.Block ( from, bytes, 1 );
+	memmove ( mem.Block ( to, bytes, 1 ), s, bytes );
+}
+
+template <class T>
+inline void block_fill ( storage_type &mem, T x, word_type n, adr_type to )
+{
+	const size_t bytes = block_bytes ( n, sizeof(T) );
+	if ( !bytes ) return;
+	char *d = mem.Block ( to, bytes, 2 );
+	for ( size_t k = 0; k < bytes; k += sizeof(T) )
+		memcpy ( d + k, &x, sizeof(T) );
+}
+
+// The element-wise quads, OP, on elements of type T
+template <char OP, class T>
+inline void block_apply ( storage_type &mem, adr_type from, word_type n,
+	adr_type to )
+{
+	const size_t bytes = block_bytes ( n, sizeof(T) );
+	if ( !bytes ) return;
+	const char *s = mem.Block ( from, bytes, 2 );
+	char *d = mem.Block ( to, bytes, 2 );
+	for ( size_t k = 0; k < bytes; k += sizeof(T) )
+	{
+		T x, y;
+		memcpy ( &x, d + k, sizeof(T) );
+		memcpy ( &y, s + k, sizeof(T) );
+		switch ( OP )
+		{
+		case 'v': case 'V': x = T ( x + y ); break;
+		case 'u': case 'U': x = T ( x - y ); break;
+		case 't': case 'T': x = T ( x * y ); break;
+		}
+		memcpy ( d + k, &x, sizeof(T) );
+	}
+}
+
+// The quads, op, whose first operand is a block
+inline void block_run ( storage_type &mem, char op, adr_type from,
+	word_type n, adr_type to )
+{
+	switch ( op )
+	{
+	case 'b': block_move ( mem, from, n, to ); break;
+	case 'v': block_apply<'v', word_type> ( mem, from, n, to ); break;
+	case 'V': block_apply<'V', float> ( mem, from, n, to ); break;
+	case 'u': block_apply<'u', word_type> ( mem, from, n, to ); break;
+	case 'U': block_apply<'U', float> ( mem, from, n, to ); break;
+	case 't': block_apply<'t', word_type> ( mem, from, n, to ); break;
+	case 'T': block_apply<'T', float> ( mem, from, n, to ); break;
+	}
+}
+
+#endif // BLOCK_H
@@ -0,0 +1,121 @@
+// dump.h
+// Memory dumps for the Compiler Theory Class interpreter
+
+// A qdumper writes the dump that a quad's '@' flag asks for: the global
+// data area, then the runtime stack (see storage_type::Dump).  With
+// changes() on, only the first dump at a quad is whole; each later one
+// at that quad shows only the rows of 16 bytes that changed since the
+// one before, so a dump inside a loop shows what the loop did.  A row
+// has changed if any of its bytes, or the dynamic links marked in it,
+// differ from the last dump, or it wasn't in the last dump at all.  The
+// bytes of each area are kept at each dump, and compared at the next.
+
+#ifndef DUMP_H
+#define DUMP_H
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstring>
+#include "storage.h"
+
+using namespace std;
+
+class qdumper
+{
+public:
+	qdumper ( const storage_type &mem, ostream &os )
+		: m_mem(mem), m_os(os), m_changes(false) {}
+	void changes ( bool on ) { m_changes = on; }
+	void clear ( void ) { m_last.clear(); }	// forget earlier dumps
+
+	// The dump at quad pc, with a global area of gsize bytes
+	void go ( size_t pc, adr_type gsize );
+
+private:
+	// An area as last dumped
+	struct area_type
+	{
+		area_type ( void ): taken(false), from(0) {}
+		bool taken;
+		size_t from;
+		vector<char> bytes;
+		vector<adr_type> marks;
+	};
+	void area ( area_type &last, size_t from, size_t n, bool stack );
+
+	const storage_type &m_mem;
+	ostream &m_os;
+	bool m_changes;
+	map<size_t, pair<area_type, area_type> > m_last;	// by quad
+};
+
+inline void qdumper::go ( size_t pc, adr_type gsize )
+{
+	static area_type none;
+	pair<area_type, area_type> *last = m_changes? &m_last[pc]: 0;
+	m_os << "Global Data Area:" << endl;
+	area ( last? last->first: none, 0, gsize, false );
+	m_os << "\nRuntime Stack Area:" << endl;
+	area ( last? last->second: none, m_mem.STop(),
+		m_mem.Size() - m_mem.STop(), true );
+}
+
+// Dump n bytes from address from: whole, or the rows that changed since
+// last, if changes are shown
+inline void qdumper::area ( area_type &last, size_t from, size_t n,
+	bool stack )
+{
+	// An empty area is a blank line (and the stack registers)
+	if ( !n )
+	{
+		if ( stack ) m_mem.Dump ( from, from - 1, true, m_os );
+		else m_os << endl;
+		if ( m_changes ) last = area_type(), last.taken = true;
+		return;
+	}
+	const adr_type adr1 = from, adr2 = from + n - 1;
+	if ( !m_changes )
+	{
+		m_mem.Dump ( adr1, adr2, stack, m_os );
+		return;
+	}
+
+	vector<adr_type> marks;
+	m_mem.Marks ( adr1, adr2, marks );
+	const char *image = m_mem.Image();
+	if ( !last.taken )
+		m_mem.Dump ( adr1, adr2, stack, m_os );
+	else
+	{
+		vector<bool> rows ( (n + 15) / 16 );
+		const size_t end = last.from + last.bytes.size();
+		const vector<adr_type> &lmarks = last.marks;
+		size_t m = 0, lm = 0;
+		while ( lm < lmarks.size() && lmarks[lm] < from ) ++lm;
+		for ( size_t r = 0; r < rows.size(); ++r )
+		{
+			const size_t a = from + 16 * r;
+			const size_t len = min ( size_t ( 16 ), from + n - a );
+			// The links marked in the row, now and then
+			const size_t m0 = m, lm0 = lm;
+			while ( m < marks.size() && marks[m] < a + len ) ++m;
+			while ( lm < lmarks.size() && lmarks[lm] < a + len ) ++lm;
+			rows[r] = a < last.from || a + len > end
+				|| memcmp ( image + a, &last.bytes[a - last.from], len ) != 0
+				|| m - m0 != lm - lm0
+				|| !equal ( marks.begin() + m0, marks.begin() + m,
+					lmarks.begin() + lm0 );
+		}
+		m_mem.Dump ( adr1, adr2, stack, m_os, &rows );
+	}
+
+	// Keep this dump, for the next to compare with
+	last.taken = true;
+	last.from = from;
+	last.bytes.assign ( image + from, image + from + n );
+	last.marks.swap ( marks );
+}
+
+#endif // DUMP_H
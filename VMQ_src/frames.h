@@ -0,0 +1,305 @@
+// frames.h
+// Frame analysis for the Compiler Theory Class interpreter
+
+// A function is entered at a '#' quad that a call (or the '$' quad)
+// transfers to; its body is the code reached from the quad after that
+// without another call.  qframer looks at each function whose body
+// belongs to it alone, and finds the slots of its frame (locals and
+// parameters, as /-n and /n operands) that native code can keep in host
+// registers: slots the body reads and writes only as whole shorts or
+// addresses at a fixed offset from the dynamic link, and whose address
+// it does not take.  The most used ones, counting uses within loops more,
+// are chosen.
+//
+// Native code keeps the chosen slots in registers while it runs the body,
+// and writes them back to emulated memory before anything else could
+// look at them there (see jit.h).
+
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <climits>
+#include "quad.h"
+#include "threaded.h"
+
+using namespace std;
+
+struct qframe_type
+{
+	size_t entry;		// the '#' quad
+	vector<short> slots;	// offsets from the link of slots in registers
+	int lo, hi;		// the slots lie in [link+lo, link+hi)
+	int dirend;		// absolute operands of the body lie below this
+};
+
+class qframer
+{
+public:
+	qframer ( const quad_list &qlist, const vector<dquad_type> &code,
+		size_t nregs )
+		: m_qlist(qlist), m_code(code), m_nregs(nregs) {}
+	void go ( void );
+
+	// The function with slots in registers whose body quad i is in, or
+	// whose entry it is, or -1
+	int body ( size_t i ) const { return m_body[i]; }
+	int entry ( size_t i ) const { return m_entry[i]; }
+	const qframe_type &frame ( int f ) const { return m_frames[f]; }
+
+private:
+	enum { SHARED = -2 };
+	void successors ( size_t i, vector<size_t> &next ) const;
+	int width ( size_t i, int k ) const;
+	bool choose ( qframe_type &f, const vector<int> &owner, int id ) const;
+
+	const quad_list &m_qlist;
+	const vector<dquad_type> &m_code;
+	size_t m_nregs;
+	vector<qframe_type> m_frames;
+	vector<int> m_body, m_entry;
+};
+
+inline void qframer::go ( void )
+{
+	const size_t n = m_qlist.size();
+	m_body.assign ( n, -1 );
+	m_entry.assign ( n, -1 );
+
+	// Entries: '#' quads that calls and the '$' quad go to
+	vector<size_t> entries;
+	for ( size_t i = 0; i < n; ++i )
+	{
+		const dquad_type &d = m_code[i];
+		short t = -1;
+		if ( m_qlist[i].op() == 'c' && d.v2.s >= 0 ) t = d.v2.s;
+		if ( m_qlist[i].op() == '$' ) t = d.v1.s;
+		if ( t >= 0 && size_t ( t ) < n && m_qlist[t].op() == '#' )
+			entries.push_back ( t );
+	}
+	sort ( entries.begin(), entries.end() );
+	entries.erase ( unique ( entries.begin(), entries.end() ), entries.end() );
+
+	// Bodies.  A body must not be shared, or reached other than from its
+	// entry, or change the link except by calls.
+	vector<int> owner ( n, -1 );
+	vector<bool> bad ( entries.size(), false );
+	vector<size_t> work, next;
+	for ( size_t f = 0; f < entries.size(); ++f )
+	{
+		const size_t e = entries[f];
+		if ( e + 1 < n ) work.push_back ( e + 1 );
+		while ( !work.empty() )
+		{
+			const size_t q = work.back();
+			work.pop_back();
+			if ( owner[q] == int ( f ) ) continue;
+			if ( owner[q] != -1 )
+			{
+				if ( owner[q] >= 0 ) bad[owner[q]] = true;
+				bad[f] = true;
+				owner[q] = SHARED;
+				continue;
+			}
+			owner[q] = f;
+			const char op = m_qlist[q].op();
+			if ( op == '#' || op == '$' ) bad[f] = true;
+			successors ( q, next );
+			for ( size_t k = 0; k < next.size(); ++k )
+			{
+				if ( next[k] == e ) bad[f] = true;
+				work.push_back ( next[k] );
+			}
+		}
+	}
+	for ( size_t q = 0; q < n; ++q )
+	{
+		// Calls and the '$' quad may go only to entries
+		const dquad_type &d = m_code[q];
+		short t = -1;
+		if ( m_qlist[q].op() == 'c' && d.v2.s >= 0 ) t = d.v2.s;
+		if ( m_qlist[q].op() == '$' ) t = d.v1.s;
+		if ( t >= 0 && size_t ( t ) < n && owner[t] >= 0 )
+			bad[owner[t]] = true;
+
+		if ( owner[q] >= 0 ) continue;
+		successors ( q, next );
+		for ( size_t k = 0; k < next.size(); ++k )
+		{
+			const int g = owner[next[k]];
+			if ( g >= 0 && q != entries[g] ) bad[g] = true;
+		}
+	}
+
+	// Slots of the functions that are left
+	for ( size_t f = 0; f < entries.size(); ++f )
+	{
+		if ( bad[f] ) continue;
+		qframe_type fr;
+		fr.entry = entries[f];
+		if ( !choose ( fr, owner, f ) ) continue;
+		const int id = m_frames.size();
+		m_frames.push_back ( fr );
+		m_entry[fr.entry] = id;
+		for ( size_t q = 0; q < n; ++q )
+			if ( owner[q] == int ( f ) ) m_body[q] = id;
+	}
+}
+
+// Quads control can pass to from quad i within a function; a call
+// returns to the next quad
+inline void qframer::successors ( size_t i, vector<size_t> &next ) const
+{
+	const dquad_type &d = m_code[i];
+	next.clear();
+	switch ( m_qlist[i].op() )
+	{
+	case 'l': case 'g': case 'e': case 'L': case 'G': case 'E':
+		next.push_back ( i + 1 );
+		next.push_back ( d.v3.s );
+		break;
+	case 'j':
+		next.push_back ( d.v1.s );
+		break;
+	case '/': case 'h': case '$': case '#':
+		break;
+	default:
+		next.push_back ( i + 1 );
+	}
+	// Not the end marker
+	for ( size_t k = next.size(); k-- > 0; )
+		if ( next[k] >= m_qlist.size() ) next.erase ( next.begin() + k );
+}
+
+// Bytes of memory operand k (1..3) of quad i reads or writes, or 0 if it
+// is not a data operand
+inline int qframer::width ( size_t i, int k ) const
+{
+	switch ( m_qlist[i].op() )
+	{
+	case 'a': case 's': case 'm': case 'd': case 'r': case '|': case '&':
+	case 'i': case '~': case 'n':
+		return 2;
+	case 'l': case 'g': case 'e':
+		return k < 3? 2: 0;
+	case 'A': case 'S': case 'M': case 'D': case 'I': case 'N':
+		return 4;
+	case 'L': case 'G': case 'E':
+		return k < 3? 4: 0;
+	case '=':
+		return 1;
+	case 'F':
+		return k == 1? 2: 4;
+	case 'f':
+		return k == 1? 4: 2;
+	case 'c':
+		return k == 1 && m_code[i].v2.s >= 0? 2: 0;
+	case 'p':
+		return k == 1? 2: 0;
+	case 'P':
+		return k == 1? 4: 0;
+	}
+	return 0;
+}
+
+// Choose the slots of function f (body quads have owner id); false if
+// there are none
+inline bool qframer::choose ( qframe_type &f, const vector<int> &owner,
+	int id ) const
+{
+	const size_t n = m_qlist.size();
+	const int size = m_code[f.entry].v1.s; // of the locals
+
+	// Quads within loops: between a backward jump and its target
+	vector<bool> loop ( n, false );
+	vector<size_t> next;
+	for ( size_t q = 0; q < n; ++q )
+	{
+		if ( owner[q] != id ) continue;
+		successors ( q, next );
+		for ( size_t k = 0; k < next.size(); ++k )
+			if ( next[k] <= q )
+				for ( size_t j = next[k]; j <= q; ++j ) loop[j] = true;
+	}
+
+	map<int, long> uses;	// of each slot offset, as a whole short
+	set<int> other;		// offsets of bytes used any other way
+	int taken = INT_MAX;	// the address of slots from here up is taken
+	f.dirend = 0;
+	for ( size_t q = 0; q < n; ++q )
+	{
+		if ( owner[q] != id ) continue;
+		const dquad_type &d = m_code[q];
+		const opval *v[3] = { &d.v1, &d.v2, &d.v3 };
+		const unsigned char m[3] = { d.m1, d.m2, d.m3 };
+		for ( int k = 0; k < 3; ++k )
+		{
+			const int w = width ( q, k + 1 );
+			if ( !w ) continue;
+			switch ( m[k] )
+			{
+			case AM_DIR:
+				f.dirend = max ( f.dirend, int ( v[k]->a ) + w );
+				break;
+			case AM_IND:
+				f.dirend = max ( f.dirend, int ( v[k]->a ) + 2 );
+				break;
+			case AM_REL:
+			case AM_RELIND:
+			{
+				// The pointer of /@n is a short, whatever it points to
+				const int b = m[k] == AM_RELIND? 2: w;
+				if ( b == 2 && !(v[k]->s & 1) )
+					uses[v[k]->s] += loop[q]? 8: 1;
+				else
+					for ( int j = 0; j < b; ++j ) other.insert ( v[k]->s + j );
+				break;
+			}
+			case AM_RELIMM:
+			{
+				// Pushing an address for a pseudo-call to use is safe:
+				// slots are written back before pseudo-calls.  The
+				// array calls take more than one push.
+				size_t c = q;
+				while ( m_qlist[c].op() == 'p' && c + 1 < n ) ++c;
+				if ( !( m_qlist[q].op() == 'p' && m_qlist[c].op() == 'c'
+						&& m_code[c].v2.s < 0 ) )
+					taken = min ( taken, int ( v[k]->s ) );
+				break;
+			}
+			}
+		}
+	}
+
+	// Whole short slots of the locals (below the link) or parameters
+	// (above the return address), most used first
+	vector< pair<long, int> > best;
+	for ( map<int, long>::const_iterator u = uses.begin(); u != uses.end();
+		++u )
+	{
+		const int s = u->first;
+		if ( (s & 1) || s >= taken || other.count ( s )
+			|| other.count ( s + 1 ) )
+			continue;
+		if ( !( (s >= -size && s <= -2) || s >= 4 ) ) continue;
+		best.push_back ( make_pair ( -u->second, s ) );
+	}
+	sort ( best.begin(), best.end() );
+	if ( best.size() > m_nregs ) best.resize ( m_nregs );
+	if ( best.empty() ) return false;
+
+	f.lo = INT_MAX;
+	f.hi = INT_MIN;
+	for ( size_t k = 0; k < best.size(); ++k )
+	{
+		f.slots.push_back ( best[k].second );
+		f.lo = min ( f.lo, best[k].second );
+		f.hi = max ( f.hi, best[k].second + 2 );
+	}
+	return true;
+}
+
+#endif // FRAMES_H
@@ -0,0 +1,304 @@
+// input.h
+// Input of the read pseudo-calls for the Compiler Theory Class interpreter
+
+// An in_scanner reads what a program reads, from standard input in large
+// blocks or from a whole (mapped) input file, and scans shorts, floats
+// and lines from it in place.  It reads them exactly as cin >> and
+// getline did: the same characters make up a number, a value out of
+// range gives the nearest limit, and once a read fails, or one reaches
+// the end of the input, all later reads fail.  A failed read gives 0 (an
+// empty line for getline).
+//
+// Before it waits for more of standard input, it flushes the program's
+// output, so prompts appear first.
+//
+// Each thread has a scanner of its own.  A source, if one is set, takes
+// the place of standard input.  While the scanner is held, the engines
+// stop before each read pseudo-call, so that a snapshot can be taken
+// there (see snapshot.h); the scanner itself reads nothing.
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <charconv>
+#include <climits>
+#include <limits>
+#include <cfloat>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include "mapfile.h"
+#include "output.h"
+
+// Standard input is read with read(2) where there is one; elsewhere, a
+// line at a time with getchar
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_UNISTD
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Reads up to n bytes of input into buf, for ctx; returns how many were
+// read, or 0 at the end
+typedef long (*in_source) ( void *ctx, char *buf, size_t n );
+
+class in_scanner
+{
+public:
+	in_scanner ( void ): m_data(""), m_pos(0), m_len(0), m_file(false),
+		m_ended(false), m_eof(false), m_fail(false), m_source(0),
+		m_ctx(0), m_held(false) {}
+	bool open ( const char *fname );	// false, with errno set, on failure
+
+	// Start over, reading from f (standard input if f is 0), or the n
+	// bytes at p
+	void source ( in_source f, void *ctx );
+	void text ( const char *p, size_t n );
+
+	// Each returns false if the read failed
+	bool get ( word_type &x );
+	bool get ( float &x );
+	bool getline ( string &x );
+
+	void hold ( bool on ) { m_held = on; }
+	bool held ( void ) const { return m_held; }
+
+private:
+	enum { BLOCK = 65536 };
+	static bool space ( int c )
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f'
+			|| c == '\r';
+	}
+	static bool digit ( int c ) { return c >= '0' && c <= '9'; }
+
+	// Character i past the next one to be read, or -1 past the end
+	int at ( size_t i )
+	{
+		while ( m_pos + i >= m_len )
+			if ( !fill() ) return -1;
+		return (unsigned char)m_data[m_pos + i];
+	}
+	bool fill ( void );
+	bool start ( void );
+
+	mapped_file m_map;
+	vector<char> m_buf;	// from standard input
+	const char *m_data;	// the input at hand; m_pos is the next to read
+	size_t m_pos, m_len;
+	bool m_file;		// all the input is at hand
+	bool m_ended;		// no more to read
+	bool m_eof, m_fail;	// as the stream state bits
+	in_source m_source;
+	void *m_ctx;
+	bool m_held;
+};
+
+inline bool in_scanner::open ( const char *fname )
+{
+	if ( !m_map.open ( fname ) ) return false;
+	text ( m_map.data(), m_map.size() );
+	return true;
+}
+
+inline void in_scanner::source ( in_source f, void *ctx )
+{
+	m_data = "";
+	m_pos = m_len = 0;
+	m_file = m_ended = m_eof = m_fail = false;
+	m_source = f;
+	m_ctx = ctx;
+}
+
+inline void in_scanner::text ( const char *p, size_t n )
+{
+	source ( 0, 0 );
+	m_data = p;
+	m_len = n;
+	m_file = true;
+}
+
+// Read another block of standard input, keeping what hasn't been read
+inline bool in_scanner::fill ( void )
+{
+	if ( m_file || m_ended ) return false;
+	qout.flush();
+	cout.flush();
+	if ( m_pos )
+	{
+		memmove ( &m_buf[0], &m_buf[m_pos], m_len - m_pos );
+		m_len -= m_pos;
+		m_pos = 0;
+	}
+	if ( m_buf.size() < m_len + BLOCK ) m_buf.resize ( m_len + BLOCK );
+	m_data = &m_buf[0];
+	long n;
+	if ( m_source )
+		n = m_source ( m_ctx, &m_buf[m_len], m_buf.size() - m_len );
+	else
+	{
+#ifdef HAVE_UNISTD
+		do
+			n = ::read ( 0, &m_buf[m_len], m_buf.size() - m_len );
+		while ( n < 0 && errno == EINTR );
+#else
+		// A line at a time, as a terminal gives it
+		int c = 0;
+		for ( n = 0; size_t ( n ) < m_buf.size() - m_len && c != '\n'; ++n )
+		{
+			if ( (c = getchar()) == EOF ) break;
+			m_buf[m_len + n] = c;
+		}
+#endif
+	}
+	if ( n <= 0 )
+	{
+		m_ended = true;
+		return false;
+	}
+	m_len += n;
+	return true;
+}
+
+// What the sentry of >> does: fail if reading has failed or reached the
+// end, and skip whitespace
+inline bool in_scanner::start ( void )
+{
+	int c = m_fail || m_eof? -1: at ( 0 );
+	while ( space ( c ) )
+	{
+		++m_pos;
+		c = at ( 0 );
+	}
+	if ( c < 0 )
+	{
+		m_eof = m_fail = true;
+		return false;
+	}
+	return true;
+}
+
+// A decimal integer with an optional sign, read as a long and narrowed
+inline bool in_scanner::get ( word_type &x )
+{
+	x = 0;
+	if ( !start() ) return false;
+	size_t n = 0;
+	int c = at ( 0 );
+	const bool neg = c == '-';
+	if ( c == '-' || c == '+' ) c = at ( ++n );
+	const size_t d = n;
+	while ( digit ( c ) ) c = at ( ++n );
+	if ( c < 0 ) m_eof = true;
+	const char *p = m_data + m_pos;
+	m_pos += n;
+	if ( n == d )
+	{
+		m_fail = true;
+		return false;
+	}
+
+	unsigned long long m;
+	if ( from_chars ( p + d, p + n, m ).ec == errc::result_out_of_range )
+		m = ULLONG_MAX;
+	const word_type lo = numeric_limits<word_type>::min(),
+		hi = numeric_limits<word_type>::max();
+	if ( neg && m > (unsigned long long)-(long long)lo )
+		x = lo;
+	else if ( !neg && m > (unsigned long long)hi )
+		x = hi;
+	else
+	{
+		x = neg? word_type ( -(long)m ): word_type ( m );
+		return true;
+	}
+	m_fail = true;
+	return false;
+}
+
+// Digits with at most one '.', then an exponent if there were digits.  All
+// of that must make a number, or the value is 0; too large gives the
+// largest float.
+inline bool in_scanner::get ( float &x )
+{
+	x = 0;
+	if ( !start() ) return false;
+	size_t n = 0;
+	int c = at ( 0 );
+	if ( c == '-' || c == '+' ) c = at ( ++n );
+	bool mantissa = false, point = false, sci = false, exponent = false;
+	for ( ;; c = at ( ++n ) )
+	{
+		if ( digit ( c ) )
+		{
+			mantissa = true;
+			exponent = sci;
+		}
+		else if ( c == '.' && !point && !sci )
+			point = true;
+		else if ( (c == 'e' || c == 'E') && mantissa && !sci )
+		{
+			sci = true;
+			c = at ( n + 1 );
+			if ( c == '+' || c == '-' ) ++n;
+		}
+		else
+			break;
+	}
+	if ( c < 0 ) m_eof = true;
+	const char *p = m_data + m_pos;
+	m_pos += n;
+	if ( !mantissa || (sci && !exponent) )
+	{
+		m_fail = true;
+		return false;
+	}
+
+	const char *s = *p == '+'? p + 1: p; // from_chars takes no '+'
+	if ( from_chars ( s, p + n, x ).ec == errc::result_out_of_range )
+	{
+		// Too small gives what strtof gives
+		x = strtof ( string ( s, p + n ).c_str(), 0 );
+		if ( x > FLT_MAX || x < -FLT_MAX )
+		{
+			x = x > 0? FLT_MAX: -FLT_MAX;
+			m_fail = true;
+			return false;
+		}
+	}
+	return true;
+}
+
+// The rest of the line, without its '\n'
+inline bool in_scanner::getline ( string &x )
+{
+	x.clear();
+	if ( m_fail || m_eof )
+	{
+		m_fail = true;
+		return false;
+	}
+	size_t n = 0;
+	int c;
+	while ( (c = at ( n )) >= 0 && c != '\n' ) ++n;
+	x.assign ( m_data + m_pos, n );
+	m_pos += n;
+	if ( c >= 0 )
+	{
+		++m_pos;
+		return true;
+	}
+	m_eof = true;
+	if ( !n ) m_fail = true;
+	return n != 0;
+}
+
+// The input of the program this thread runs (vmq.cpp, libvmq.cpp)
+extern thread_local in_scanner qin;
+
+#endif // INPUT_H
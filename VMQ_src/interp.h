@@ -0,0 +1,806 @@
+// interp.h
+// Program execution for the Compiler Theory Class interpreter
+
+// Copyright 2002 Raymond L. Zarling
+
+#ifndef INTERP_H
+#define INTERP_H
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cctype>
+#include "storage.h"
+#include "quad.h"
+#include "output.h"
+#include "input.h"
+#include "threaded.h"
+#include "jit.h"
+#include "aot.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "dump.h"
+#include "tracebin.h"
+#include "block.h"
+
+using namespace std;
+
+// Routines to interpret a program execution.  Traces and dumps go to
+// out, and errors to err.  go() runs the program in memory from its
+// start, and returns the level of the worst error; it may be called
+// again, with memory reset, and reuses the decoded (and native) code.
+//
+// snapshot() runs the program as go() would, but stops it before its
+// first read and keeps the state there in a qsnapshot (see snapshot.h);
+// go() with that snapshot puts it back and carries on.  A program that
+// traces or dumps, or is profiled, or runs translated code, runs from
+// its start instead, and takes no snapshot.
+class interpreter
+{
+public:
+	interpreter ( storage_type &mem, const quad_list &qlist,
+		bool use_switch = false, bool use_jit = true,
+		aot_module *native = 0, bool use_regs = true,
+		qprofile *profile = 0, ostream &out = cout, ostream &err = cerr )
+		: m_mem(mem), m_qlist(qlist), m_switch(use_switch),
+		  m_jit(use_jit), m_regs(use_regs), m_native(native),
+		  m_profile(profile), m_out(out), m_err(err), m_dumper(mem, out),
+		  m_run(0), m_jitcode(0), m_ready(false), m_tracing(false),
+		  m_tracer(0) {}
+	~interpreter ();
+	int go ( void ) { return start ( 0, 0 ); }
+	int go ( const qsnapshot &from ) { return start ( &from, 0 ); }
+	int snapshot ( qsnapshot &into );
+
+	// Run quads decoded by qdecoder, which other interpreters may share,
+	// rather than decoding them again (not when profiling)
+	void share ( const vector<dquad_type> &code ) { m_run = &code; }
+	// Show only what changed since the last dump at the same quad
+	void dump_changes ( bool on ) { m_dumper.changes ( on ); }
+	// Record every quad run into a binary trace, on the switch engine
+	void trace ( qtrace *t ) { m_tracer = t; }
+
+private:
+	int start ( const qsnapshot *from, qsnapshot *into );
+	template <bool DIAG, bool PROF> bool run_switch ( void );
+	int go_threaded ( const qsnapshot *from, qsnapshot *into );
+	bool diagnostics ( void ) const;
+	void posterror ( int level, const string &msg ) const;
+	void traceresult ( adr_type res_adr, char res_type );
+	void traceblock ( adr_type adr, size_t bytes );
+
+	storage_type &m_mem;
+	const quad_list &m_qlist;
+	bool m_switch;	// run the switch engine, not the threaded one
+	bool m_jit;	// run native code, if it can be made, before threaded
+	bool m_regs;	// let native code keep frame slots in registers
+	aot_module *m_native;	// translated code to run in its place, or 0
+	qprofile *m_profile;	// count the quads run into this, or 0
+	ostream &m_out, &m_err;
+	qdumper m_dumper;	// for quads with '@' flags
+	vector<dquad_type> m_code;	// decoded quads, once decoded
+	vector<handler_type> m_handlers;	// ... their own, when profiling
+	const vector<dquad_type> *m_run;	// those run: m_code, or shared
+#ifdef HAVE_JIT
+	qjit *m_jitcode;	// native code, if it could be made
+#else
+	void *m_jitcode;
+#endif
+	bool m_ready;	// the code to run is made
+	adr_type m_pc;	// current program counter
+	adr_type m_cur_pc; // pc of current instruction, even after ++m_pc
+	adr_type m_gsize; // size of global data area
+	bool m_running; // a '$' has been executed
+	bool m_paused; // stopped before a read, as qin is held
+	vector<char> m_ops; // ops of quads, 0 for those with diagnostic flags
+	bool m_tracing;
+	qtrace *m_tracer;	// the binary trace, or 0
+	mutable int m_errorlevel;
+
+	interpreter ( const interpreter & );	// not copied
+	void operator = ( const interpreter & );
+};
+
+inline interpreter::~interpreter ()
+{
+#ifdef HAVE_JIT
+	delete m_jitcode;
+#endif
+}
+
+// Run to the first read, and keep the state there
+inline int interpreter::snapshot ( qsnapshot &into )
+{
+	if ( diagnostics() || m_profile || m_native ) return go();
+	// What the program writes belongs to the snapshot
+	into.output().clear();
+	qout.divert ( &into.output() );
+	qin.hold ( true );
+	const int level = start ( 0, &into );
+	qin.hold ( false );
+	qout.divert ( 0 );
+	// ... unless it stopped before it read anything
+	if ( !into.taken() ) qout.write ( into.output().data(),
+		into.output().size() );
+	return level;
+}
+
+// Run the simulated machine, from its start or a snapshot, and into a
+// snapshot if into is not 0
+inline int interpreter::start ( const qsnapshot *from, qsnapshot *into )
+{
+	if ( from && (!from->taken() || diagnostics() || m_profile || m_native) )
+		from = 0;
+	m_errorlevel = 0;
+	m_tracing = false;
+	m_dumper.clear();
+	size_t nquads = m_qlist.size();
+
+	// Get start address
+	if ( nquads == 0 ) return m_errorlevel;
+	if ( m_qlist.op ( 0 ) != '$' )
+	{
+		posterror ( ERR_ERROR, "First quad must be '$'" );
+		return m_errorlevel;
+	}
+
+	if ( from )
+	{
+		from->restore ( m_mem );
+		qout.write ( from->output().data(), from->output().size() );
+	}
+
+	// The threaded engine neither traces nor dumps, so programs that
+	// ask for diagnostics run on the switch engine below.
+	if ( !m_switch && !diagnostics() ) return go_threaded ( from, into );
+
+	// The switch engine.  A lean loop, with no diagnostics, runs until
+	// it reaches a quad with diagnostic flags; the instrumented one runs
+	// from there on.
+	m_ops.resize ( nquads );
+	for ( size_t i = 0; i < nquads; ++i )
+	{
+		m_ops[i] = m_qlist.flags ( i ) || m_tracer? 0:
+			m_qlist.op ( i );
+	}
+	m_pc = from? from->pc(): 0;
+	m_gsize = from? from->gsize(): 0;
+	m_running = from != 0;
+	m_paused = false;
+	try
+	{
+		if ( !m_profile )
+		{
+			if ( run_switch<false, false>() ) run_switch<true, false>();
+		}
+		else if ( run_switch<false, true>() )
+			run_switch<true, true>();
+	}
+	catch ( runtime_error &e )
+	{
+		posterror ( ERR_ERROR, e.what() );
+	}
+	if ( m_paused && into ) into->take ( m_mem, m_pc, m_gsize );
+
+	return m_errorlevel;
+}
+
+// The interpretive loop, instrumented for diagnostics if DIAG, and
+// counting each quad it runs if PROF.  Returns true if it stops (without
+// DIAG) at a quad with diagnostic flags.
+template <bool DIAG, bool PROF>
+bool interpreter::run_switch ( void )
+{
+	bool stop = false; // respond to 'h' quad
+
+	// Main Interpretive Loop
+	const quad_list::reader quads ( m_qlist );
+	const size_t nquads = m_qlist.size();
+	qop op1, op2, op3; // The up-to-3 operands
+	adr_type res_adr; // If there's a memory result, its absolute address
+	char res_type = 's'; // If there's a memory result, 'a', 's' or 'f'
+	unsigned long long *counts = PROF? m_profile->counts(): 0;
+	while ( !stop )
+	{
+		m_cur_pc = m_pc;
+		// A label past the end, or the last quad falling through, leaves
+		// the program, as the threaded engine's exec_offend stops
+		if ( m_pc >= nquads )
+		{
+			posterror ( ERR_ERROR,
+				"Control passed outside the quad list: STOP" );
+			return false;
+		}
+		const char cur_op = DIAG? quads.op ( m_pc ): m_ops[m_pc];
+
+		// The lean loop leaves a quad with flags for the other to count
+		if ( PROF && (DIAG || cur_op != 0) )
+			++counts[m_pc];
+
+		// Act on diagnostic flags
+		const unsigned char flags = DIAG? m_qlist.flags ( m_pc ): 0;
+		if ( flags & QF_TRON ) m_tracing = true;
+		if ( flags & QF_TROFF ) m_tracing = false;
+		// Diagnostics follow what the program has written
+		if ( DIAG && (m_tracing || (flags & QF_DUMP)) ) qout.flush();
+		if ( flags & QF_DUMP ) m_dumper.go ( m_pc, m_gsize );
+
+		if ( DIAG && m_tracing ) m_out << setw(4) << m_pc << ": "
+			<< m_qlist[m_pc]; // Do endl later...
+		if ( DIAG && m_tracer ) m_tracer->begin ( m_pc );
+
+		// Do the operation
+		switch ( cur_op )
+		{
+		// 3 address quads
+		case 'a': case 'A': case 's': case 'S': case 'm': case 'M':
+		case 'd': case 'D': case 'r': case '|': case '&':
+			quads.op1 ( m_pc, op1 );
+			quads.op2 ( m_pc, op2 );
+			quads.op3 ( m_pc, op3 );
+			res_adr = op3.lval(m_mem);
+			if ( (cur_op == 'd' || cur_op == 'r') && op2.sval(m_mem) == 0 )
+			{
+				posterror ( ERR_ERROR, "Division by zero: STOP" );
+				return false;
+			}
+			m_pc++;
+			switch ( cur_op )
+			{
+			case 'a': m_mem.Set ( res_adr,
+					word_type(op1.sval(m_mem) + op2.sval(m_mem)) );
+				res_type = 's';
+				break;
+			case 'A': m_mem.Set ( res_adr,
+					float(op1.fval(m_mem) + op2.fval(m_mem)) );
+				res_type = 'f';
+				break;
+			case 's': m_mem.Set ( res_adr,
+					word_type(op1.sval(m_mem) - op2.sval(m_mem)) );
+				res_type = 's';
+				break;
+			case 'S': m_mem.Set ( res_adr,
+					float(op1.fval(m_mem) - op2.fval(m_mem)) );
+				res_type = 'f';
+				break;
+			case 'm': m_mem.Set ( res_adr,
+					word_type(op1.sval(m_mem) * op2.sval(m_mem)) );
+				res_type = 's';
+				break;
+			case 'M': m_mem.Set ( res_adr,
+					float(op1.fval(m_mem) * op2.fval(m_mem)) );
+				res_type = 'f';
+				break;
+			case 'd': m_mem.Set ( res_adr,
+					word_type(op1.sval(m_mem) / op2.sval(m_mem)) );
+				res_type = 's';
+				break;
+			case 'D': m_mem.Set ( res_adr,
+					float(op1.fval(m_mem) / op2.fval(m_mem)) );
+				res_type = 'f';
+				break;
+			case 'r': m_mem.Set ( res_adr,
+					word_type(op1.sval(m_mem) % op2.sval(m_mem)) );
+				res_type = 's';
+				break;
+			case '|': m_mem.Set ( res_adr,
+					word_type(op1.sval(m_mem) | op2.sval(m_mem)) );
+				res_type = 's';
+				break;
+			case '&': m_mem.Set ( res_adr,
+					word_type(op1.sval(m_mem) & op2.sval(m_mem)) );
+				res_type = 's';
+				break;
+			}
+			if ( DIAG && m_tracing ) traceresult ( res_adr, res_type );
+			if ( DIAG && m_tracer ) m_tracer->result ( m_mem, res_adr,
+				res_type == 'f'? sizeof(float): sizeof(word_type) );
+			break;
+
+		// Quads with 2 addresses and a label
+		case 'l': case 'L': case 'g': case 'G': case 'e': case 'E':
+			quads.op1 ( m_pc, op1 );
+			quads.op2 ( m_pc, op2 );
+			quads.op3 ( m_pc, op3 );
+			m_pc++; // in case branch is not taken
+			{
+				bool take = false; // take the branch?
+				switch ( cur_op )
+				{
+				case 'l':
+					take = (op1.sval(m_mem) < op2.sval(m_mem));
+					break;
+				case 'L':
+					take = (op1.fval(m_mem) < op2.fval(m_mem));
+					break;
+				case 'g':
+					take = (op1.sval(m_mem) > op2.sval(m_mem));
+					break;
+				case 'G':
+					take = (op1.fval(m_mem) > op2.fval(m_mem));
+					break;
+				case 'e':
+					take = (op1.sval(m_mem) == op2.sval(m_mem));
+					break;
+				case 'E':
+					take = (op1.fval(m_mem) == op2.fval(m_mem));
+					break;
+				}
+				if ( DIAG && m_tracer ) m_tracer->branch ( take,
+					op3.ival(m_mem) );
+				if ( take )
+				{
+					m_pc = op3.ival(m_mem);
+					if ( DIAG && m_tracing && cur_op != 'c' )
+						m_out << " --> branch to " << m_pc;
+				}
+				else
+				{
+					if ( DIAG && m_tracing && cur_op != 'c' )
+						m_out << " --> branch not taken";
+				}
+			}
+			break;
+
+		// 2 address quads
+		case 'i': case 'I': case '=': case 'F': case 'f':
+		case '~': case 'n': case 'N':
+			quads.op1 ( m_pc, op1 );
+			quads.op2 ( m_pc, op2 );
+			res_adr = op2.lval(m_mem);
+			m_pc++;
+			switch ( cur_op )
+			{
+			case 'i': m_mem.Set ( res_adr, op1.sval(m_mem) );
+				res_type = 's';
+				break;
+			case 'I': m_mem.Set ( res_adr, op1.fval(m_mem) );
+				res_type = 'f';
+				break;
+			case '=': m_mem.Set ( res_adr, char(op1.cval(m_mem)) );
+				res_type = 'c';
+				break;
+			case 'F': m_mem.Set ( res_adr, float( op1.sval(m_mem) ) );
+				res_type = 'f';
+				break;
+			case 'f': m_mem.Set ( res_adr, word_type( op1.fval(m_mem) ) );
+				res_type = 's';
+				break;
+			case '~': m_mem.Set ( res_adr, word_type( ~op1.sval(m_mem) ) );
+				res_type = 's';
+				break;
+			case 'n': m_mem.Set ( res_adr, word_type ( -op1.sval(m_mem) ) );
+				res_type = 's';
+				break;
+			case 'N': m_mem.Set ( res_adr, float ( -op1.fval(m_mem) ) );
+				res_type = 'f';
+				break;
+			} // end switch
+			if ( DIAG && m_tracing ) traceresult ( res_adr, res_type );
+			if ( DIAG && m_tracer ) m_tracer->result ( m_mem, res_adr,
+				res_type == 'f'? sizeof(float): res_type == 'c'? 1:
+				sizeof(word_type) );
+			break;
+
+		// Block and vector quads (block.h)
+		case 'b': case 'w': case 'W': case 'v': case 'V': case 'u': case 'U':
+		case 't': case 'T':
+			quads.op1 ( m_pc, op1 );
+			quads.op2 ( m_pc, op2 );
+			quads.op3 ( m_pc, op3 );
+			res_adr = op3.lval(m_mem);
+			m_pc++;
+			{
+				word_type n = 0; // elements
+				switch ( cur_op )
+				{
+				case 'w':
+					{
+						const word_type x = op1.sval(m_mem);
+						n = op2.sval(m_mem);
+						block_fill ( m_mem, x, n, res_adr );
+					}
+					break;
+				case 'W':
+					{
+						const float x = op1.fval(m_mem);
+						n = op2.sval(m_mem);
+						block_fill ( m_mem, x, n, res_adr );
+					}
+					break;
+				default:
+					{
+						const adr_type from = op1.lval(m_mem);
+						n = op2.sval(m_mem);
+						block_run ( m_mem, cur_op, from, n, res_adr );
+					}
+					break;
+				}
+				const size_t bytes = size_t ( n ) * block_width ( cur_op );
+				if ( DIAG && m_tracing ) traceblock ( res_adr, bytes );
+				if ( DIAG && m_tracer ) m_tracer->block ( res_adr, bytes );
+			}
+			break;
+
+		// Function call with address, Label
+		case 'c':
+			quads.op1 ( m_pc, op1 );
+			quads.op2 ( m_pc, op2 );
+			m_pc++;
+			// Note: if m_tracing, the endl is handled here
+			// so we aren't in the middle of a tracing I/O
+			// during pseudo-calls to virtual I/O operations
+			if ( DIAG && m_tracing )
+				m_out << " --> Call function at " << op2.ival(m_mem) << endl;
+			if ( DIAG && m_tracer )
+			{
+				m_tracer->jump ( op2.ival(m_mem) );
+				m_tracer->done();
+			}
+			if ( op2.ival(m_mem) >= 0 ) // Real function call
+			{
+				// push result address and return address
+				m_mem.Push ( op1.aval(m_mem) );
+				m_mem.Push ( m_pc );
+				m_pc = op2.ival(m_mem);
+			}
+			else // Pseudo-function call
+			{
+				// pseudo-calls to do I/O--the variable to be
+				// set or printed is on top of the stack.
+				if ( op2.ival(m_mem) >= -5 && qin.held() )
+				{
+					// Stop before the read, for a snapshot
+					m_pc = m_cur_pc;
+					m_paused = true;
+					return false;
+				}
+				adr_type arg = m_mem.Adr ( m_mem.STop() );
+				switch ( op2.ival(m_mem) )
+				{
+				case -1: // Read int
+					{
+						word_type x;
+						qin.get ( x );
+						m_mem.Set ( arg, x );
+					}
+					break;
+				case -2: // Read float
+					{
+						float x;
+						qin.get ( x );
+						m_mem.Set ( arg, x );
+					}
+					break;
+				case -3: // Read character line
+					{
+						string x;
+						qin.getline ( x );
+						x += '\n';
+						m_mem.Set ( arg, x.c_str(), x.length()+1 );
+					}
+					break;
+				case -9: // Write int
+					{
+						word_type x = m_mem.Short(arg);
+						qout.put ( x );
+					}
+					break;
+				case -10: // Write float
+					{
+						float x = m_mem.Float(arg);
+						qout.put ( x );
+					}
+					break;
+				case -11: // Write string
+					{
+						char *x = m_mem.Str(arg);
+						qout.put ( x );
+					}
+					break;
+				// Arrays, as the other engines do them
+				case -4: d_pseudo<-4> ( m_mem ); break;
+				case -5: d_pseudo<-5> ( m_mem ); break;
+				case -12: d_pseudo<-12> ( m_mem ); break;
+				case -13: d_pseudo<-13> ( m_mem ); break;
+				default:
+					posterror ( ERR_ERROR,
+						"Unrecognized pseudo-quad number: STOP" );
+					return false;
+				} // end switch
+			} // end Pseudo-function call
+			break;
+
+		// 1 address quads
+		case 'p': case 'P':
+			quads.op1 ( m_pc, op1 );
+			m_pc++;
+			// Check for stack overflow
+			if ( m_mem.StackFull ( cur_op=='p'? sizeof(adr_type): 4,
+				m_gsize ) )
+			{
+				posterror ( ERR_FATAL, "Stack Overflow" );
+				return false;
+			}
+			if ( cur_op == 'p' )
+				m_mem.Push ( op1.aval(m_mem) );
+			else
+				m_mem.Push ( op1.fval(m_mem) );
+			if ( DIAG && m_tracing )
+			{
+				ios::fmtflags fmt = m_out.flags(); // base, internal
+				int oldfill = m_out.fill('0');
+				m_out.setf(ios::hex, ios::basefield);
+				m_out.setf(ios::internal, ios::adjustfield);
+				adr_type i;
+				m_out << " --> stack now";
+				for ( i = m_mem.STop();
+					i <= m_mem.DLink() && i < m_mem.STop()+16;
+					i += sizeof(adr_type) )
+				{
+					m_out << " " << setw(4) << m_mem.Adr(i);
+				}
+				if ( i <= m_mem.DLink() ) m_out << "...";
+				m_out.fill(oldfill);
+				m_out.flags(fmt);
+			}
+			if ( DIAG && m_tracer ) m_tracer->stack ( m_mem );
+			break;
+
+		// 2 Label  or integer literal quads
+		case '$':
+			if ( m_running )
+			{
+				posterror ( ERR_ERROR,
+					"'$' Quad may only be executed once: STOP" );
+				return false;
+			}
+			m_running = true;
+			quads.op1 ( m_pc, op1 );
+			quads.op2 ( m_pc, op2 );
+
+			m_pc = op1.ival(m_mem);
+			m_gsize = op2.ival(m_mem);
+			if ( DIAG && m_tracing ) m_out << " --> " << m_pc;
+			if ( DIAG && m_tracer ) m_tracer->jump ( m_pc );
+			break;
+
+		// 1 Label  or 1 integer literal quads
+		case 'j': case '#': case '^':
+			quads.op1 ( m_pc, op1 );
+			if ( cur_op == 'j' ) // unconditional jump
+			{
+				m_pc = op1.ival(m_mem);
+				if ( DIAG && m_tracing ) m_out << " --> " << m_pc;
+				if ( DIAG && m_tracer ) m_tracer->jump ( m_pc );
+				break;
+			}
+			m_pc++;
+			if ( cur_op == '#' ) // create stack frame
+			{
+				m_mem.Link ( op1.ival(m_mem) );
+				break;
+			}
+			if ( cur_op == '^' ) // pop runtime stack
+			{
+				size_t n = op1.ival(m_mem);
+				if ( n & 0x0001 )
+				{
+					posterror ( ERR_ERROR,
+						"Must pop an even number of bytes: STOP" );
+					return false;
+				}
+				m_mem.Pop ( n );
+				if ( DIAG && m_tracing )
+				{
+					const ios::fmtflags fmt = m_out.flags();
+					const int oldfill = m_out.fill('0');
+					m_out.setf(ios::hex, ios::basefield);
+					m_out.setf(ios::internal, ios::adjustfield);
+					m_out.setf(ios::showbase);
+					m_out << "  --> Stack Top (" << setw(6) << m_mem.STop()
+						<< ") = " << setw(6) << m_mem.Adr(m_mem.STop());
+					m_out.fill(oldfill);
+					m_out.flags(fmt);
+				}
+				if ( DIAG && m_tracer ) m_tracer->top ( m_mem );
+			}
+			break;
+
+		// No operands
+		case '/':
+			m_mem.UnLink();
+			m_pc = m_mem.Pop_Adr();
+			(void) m_mem.Pop_Adr(); // Pop adr of return value
+			if ( DIAG && m_tracing ) m_out << " --> " << m_pc;
+			if ( DIAG && m_tracer ) m_tracer->jump ( m_pc );
+			break;
+		case 'h':
+			stop = true;
+			break;
+		case ';':
+		m_pc++;
+			break;
+
+		case 0: // a quad with diagnostic flags
+			return true;
+
+		default:
+			posterror ( ERR_ERROR, "Unrecognized opcode" );
+			return false;
+		}
+
+		if ( DIAG && m_tracing && cur_op != 'c' ) m_out << endl;
+		if ( DIAG && m_tracer && cur_op != 'c' ) m_tracer->done();
+	} // end Interpretive Loop
+
+	return false;
+}
+
+// Run the program on the threaded engine (see threaded.h)
+inline int interpreter::go_threaded ( const qsnapshot *from,
+	qsnapshot *into )
+{
+	if ( !m_ready )
+	{
+		if ( !m_run )
+		{
+			// A superinstruction would run quads that begin blocks
+			// uncounted
+			qdecoder decoder ( m_qlist, m_code, !m_profile );
+			decoder.go();
+			m_run = &m_code;
+
+			// Count blocks as they start
+			if ( m_profile )
+			{
+				m_profile->count_blocks();
+				for ( size_t i = 0; i < m_code.size(); ++i )
+				{
+					m_handlers.push_back ( m_code[i].h );
+					if ( m_profile->leader ( i ) )
+						m_code[i].h = exec_probe;
+				}
+			}
+		}
+
+#ifdef HAVE_JIT
+		if ( m_jit && !m_native )
+		{
+			m_jitcode = new qjit ( m_mem, m_qlist, *m_run, m_regs,
+				m_profile );
+			if ( !m_jitcode->go() )
+			{
+				delete m_jitcode;
+				m_jitcode = 0;
+			}
+		}
+#endif
+		m_ready = true;
+	}
+
+	thread_state st ( m_mem, &(*m_run)[0], m_qlist.size() );
+	if ( from )
+	{
+		st.pc = st.code + from->pc();
+		st.gsize = from->gsize();
+		st.running = true;
+	}
+	if ( m_profile )
+	{
+		st.counts = m_profile->counts();
+		st.handlers = &m_handlers[0];
+	}
+
+	// Native code runs until it halts, or reaches a quad the threaded
+	// engine must run; the threaded engine carries on from there.
+	if ( m_native )
+	{
+		if ( m_native->run ( m_mem ) == 0 ) return m_errorlevel;
+		st.pc = st.code + m_native->regs().pc;
+		st.gsize = m_native->regs().gsize;
+		st.running = m_native->regs().running;
+	}
+#ifdef HAVE_JIT
+	else if ( m_jitcode )
+	{
+		const qjit &jit = *m_jitcode;
+		if ( m_jitcode->run ( st.pc - st.code, st.gsize, st.running ) == 0 )
+			return m_errorlevel;
+		st.pc = st.code + jit.regs().pc;
+		st.gsize = jit.regs().gsize;
+		st.running = jit.regs().running;
+		// Native code counted the block it stopped in as it started
+		if ( m_profile && m_profile->leader ( jit.regs().pc ) )
+			--st.counts[jit.regs().pc];
+	}
+#endif
+
+	try
+	{
+		run_threaded ( st );
+	}
+	catch ( fatal_error &e )
+	{
+		m_cur_pc = st.pc - st.code;
+		posterror ( ERR_FATAL, e.what() );
+	}
+	catch ( runtime_error &e )
+	{
+		m_cur_pc = st.pc - st.code;
+		posterror ( ERR_ERROR, e.what() );
+	}
+	if ( st.paused && into ) into->take ( m_mem, st.pc - st.code, st.gsize );
+
+	return m_errorlevel;
+}
+
+// Does any quad carry a trace or dump flag, or is there a binary trace?
+inline bool interpreter::diagnostics ( void ) const
+{
+	return m_qlist.flagged() || m_tracer != 0;
+}
+
+// Output the result of a memory operation for tracing
+inline void interpreter::traceresult ( adr_type res_adr, char res_type )
+{
+	const ios::fmtflags fmt = m_out.flags();
+	const int oldfill = m_out.fill('0');
+	m_out.setf(ios::showbase);
+	m_out.setf(ios::internal, ios::adjustfield);
+	m_out << hex;
+	m_out << " --> (" << setw(6) << res_adr << ") = ";
+
+	switch ( res_type )
+	{
+	case 'a': m_out << setw(6) << m_mem.Adr( res_adr ); break;
+	case 's': m_out << setw(6) << m_mem.Short(res_adr)
+		<< dec << " ( = " << m_mem.Short( res_adr ) << " )";
+		break;
+	case 'c': m_out << /*setw(4) <<*/ (unsigned short) m_mem.Char(res_adr);
+		if ( isprint ( m_mem.Char(res_adr) ) )
+			m_out << " ( = " << m_mem.Char( res_adr ) << " )";
+		break;
+	case 'f': m_out << m_mem.Float( res_adr ); break;
+	}
+	m_out.fill(oldfill);
+	m_out.flags(fmt);
+}
+
+// Output the block a block quad wrote, for tracing
+inline void interpreter::traceblock ( adr_type adr, size_t bytes )
+{
+	const ios::fmtflags fmt = m_out.flags();
+	const int oldfill = m_out.fill('0');
+	m_out.setf(ios::showbase);
+	m_out.setf(ios::internal, ios::adjustfield);
+	m_out << hex << " --> (" << setw(6) << adr << ") "
+		<< dec << bytes << " bytes";
+	m_out.fill(oldfill);
+	m_out.flags(fmt);
+}
+
+// Post a "run-time" error
+// Note that errors of level FATAL must stop the run
+inline void interpreter::posterror ( int level, const string &msg ) const
+{
+	string severity = "??? ";
+	switch ( level )
+	{
+	case ERR_WARN: severity = "Warning: "; break;
+	case ERR_ERROR: severity = "Error: "; break;
+	case ERR_FATAL: severity = "Fatal Error!: "; break;
+	}
+
+	qout.flush(); // what the program wrote comes first
+	m_err << "\nQuad address " << m_cur_pc << ": ";
+	if ( m_cur_pc < m_qlist.size() ) m_err << m_qlist[m_cur_pc];
+	m_err << endl;
+	m_err << severity << msg << endl;
+	if ( level > m_errorlevel )
+		m_errorlevel = level;
+}
+
+#endif // INTERP_H
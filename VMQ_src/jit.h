@@ -0,0 +1,885 @@
+// jit.h
+// x86-64 native code generation for the Compiler Theory Class interpreter
+
+// After the quads are decoded (threaded.h), qjit translates each one into
+// a fixed template of x86-64 instructions, with its operands and
+// addressing modes filled in, and runs the result in place of the
+// threaded engine.  The emulated stack top and dynamic link stay in
+// registers, and calls, returns and jumps stay within the native code:
+// a return goes through a table of the native address of each quad.
+//
+// Native code does only what it can do exactly as the threaded engine
+// would.  Where the threaded engine would raise an error (a misaligned
+// computed address, stack overflow, division by zero, a second '$', a
+// bad return link), and for any quad it has no template for, the native
+// code stops before the quad has any effect and the threaded engine
+// carries on from that quad, so it reports the error as it always has.
+// Pseudo-calls, and the block quads (block.h), are made through helpers
+// that do the work in C++.
+//
+// Within the body of a function (see frames.h), the most used short
+// slots of its frame live in r8d..r11d.  They are written back to emulated
+// memory before the body calls, returns, halts or leaves native code, and
+// loaded again where control comes back into the body.  The body checks
+// that no absolute or computed address it uses lies among them, and
+// leaves native code if one does.
+//
+// When profiling (see profile.h), the first quad of each basic block
+// adds one to its count as it starts.  Slots then stay in memory.
+//
+// Like the threaded engine, native code runs only verified programs.
+
+#ifndef JIT_H
+#define JIT_H
+
+#if defined(__x86_64__) && defined(__unix__) && !defined(NO_JIT) \
+	&& !defined(VMQ_WIDE)
+#define HAVE_JIT
+#endif
+
+#ifdef HAVE_JIT
+
+#include <vector>
+#include <map>
+#include <cstring>
+#include <cstddef>
+#include <sys/mman.h>
+#include "storage.h"
+#include "quad.h"
+#include "threaded.h"
+#include "frames.h"
+#include "profile.h"
+
+using namespace std;
+
+// Machine state native code keeps in memory; pc is the quad the threaded
+// engine is to continue with when native code stops
+struct jit_regs
+{
+	unsigned int gsize;	// size of global data area
+	unsigned int running;	// a '$' has been executed
+	unsigned int pc;
+	unsigned long long *counts;	// of the profile, or 0
+};
+
+class qjit
+{
+public:
+	qjit ( storage_type &mem, const quad_list &qlist,
+		const vector<dquad_type> &code, bool regs = true,
+		qprofile *profile = 0 )
+		: m_mem(mem), m_qlist(qlist), m_code(code),
+		  m_regs_on(regs && !profile), m_profile(profile),
+		  m_frames(qlist, code, 4), m_frame(-1), m_native(0), m_size(0) {}
+	~qjit ();
+	bool go ( void );	// translate; false if native code can't be run
+
+	// Run from quad pc (as from a snapshot, see snapshot.h, if not 0).
+	// Returns 0 on a halt, or nonzero when the threaded engine is to
+	// continue with the state in regs().
+	int run ( size_t pc = 0, adr_type gsize = 0, bool running = false );
+	const jit_regs &regs ( void ) const { return m_regs; }
+
+private:
+	// Registers
+	enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+		R8, R9, R10, R11, R12, R13, R14, R15 };
+	// Condition codes
+	enum { CC_B = 2, CC_E = 4, CC_NE = 5, CC_BE = 6, CC_A = 7, CC_P = 10,
+		CC_L = 12, CC_G = 15 };
+
+	// A memory operand: [base + index + disp]; index < 0 for none
+	struct mref
+	{
+		mref ( int b, int i, int d ): base(b), index(i), disp(d) {}
+		int base, index, disp;
+	};
+
+	// A short destination: a slot in register reg, or else memory
+	struct lval
+	{
+		lval ( int r, const mref &a ): reg(r), m(a) {}
+		int reg;
+		mref m;
+	};
+
+	// An exit to the threaded engine at quad pc, writing back the slots of
+	// frame first unless it is -1
+	struct bail_ref
+	{
+		bail_ref ( size_t a, size_t p, int f ): at(a), pc(p), frame(f) {}
+		size_t at, pc;
+		int frame;
+	};
+
+	// Instruction encoding
+	void byte ( unsigned x ) { m_buf.push_back ( x ); }
+	void word ( unsigned x ) { byte ( x ); byte ( x >> 8 ); }
+	void dword ( unsigned x ) { word ( x ); word ( x >> 16 ); }
+	void qword ( unsigned long long x ) { dword ( x ); dword ( x >> 32 ); }
+	void opcode ( unsigned op );
+	void op_m ( unsigned pfx, bool w, unsigned op, int reg, const mref &m );
+	void op_r ( unsigned pfx, bool w, unsigned op, int reg, int rm );
+	size_t jcc ( int cc );
+	size_t jmp ( void );
+	void patch ( size_t at, size_t to );
+
+	// Pieces of quad templates
+	mref field ( size_t off ) const { return mref ( R15, -1, off ); }
+	mref reg_field ( size_t off ) const { return mref ( RBP, -1, off ); }
+	void bail_if ( int cc );
+	void bail_plain_if ( int cc, size_t pc );
+	void check_even ( int r );
+	void check_alias ( int r, int width );
+	mref addr ( int r, const opval &v, int m, int width );
+	lval dest ( int r, const opval &v, int m );
+	void store16 ( int r, const lval &dst );
+	void sval ( int r, const opval &v, int m );
+	void cval ( int r, const opval &v, int m );
+	void aval ( int r, const opval &v, int m );
+	void fval ( int x, const opval &v, int m, int r );
+	void goto_quad ( short target ) { jump_to ( jmp(), target ); }
+	void jump_to ( size_t at, short target );
+
+	// Slots in registers
+	int preg ( const opval &v, int m ) const;
+	void spill ( int f );
+	void reload ( int f );
+	void check_frame ( int f, size_t pc );
+
+	bool quad ( size_t i );	// false if there is no template
+	void bail ( size_t i );
+
+	storage_type &m_mem;
+	const quad_list &m_qlist;
+	const vector<dquad_type> &m_code;
+	bool m_regs_on;		// keep slots of frames in registers
+	qprofile *m_profile;	// count blocks into this, or 0
+	qframer m_frames;
+	size_t m_cur;		// quad being translated
+	int m_frame;		// frame whose slots are in registers there, or -1
+
+	vector<unsigned char> m_buf;
+	vector<size_t> m_start;	// offset of the code of each quad
+	vector< pair<size_t, size_t> > m_jumps;	// rel32 to patch, quad
+	vector<bail_ref> m_bails;
+	vector<size_t> m_exits;	// rel32 to patch to the epilogue
+	vector<const void *> m_table;	// native address of each quad
+
+	jit_regs m_regs;
+	void *m_native;
+	size_t m_size;
+};
+
+inline qjit::~qjit ()
+{
+	if ( m_native ) munmap ( m_native, m_size );
+}
+
+inline void qjit::opcode ( unsigned op )
+{
+	if ( op > 0xff ) byte ( op >> 8 );
+	byte ( op );
+}
+
+// Instruction with a memory operand: prefix, REX, opcode, ModRM, SIB,
+// 32-bit displacement
+inline void qjit::op_m ( unsigned pfx, bool w, unsigned op, int reg,
+	const mref &m )
+{
+	if ( pfx ) byte ( pfx );
+	const unsigned rex = (w? 8: 0) | (reg & 8? 4: 0)
+		| (m.index >= 8? 2: 0) | (m.base & 8? 1: 0);
+	if ( rex ) byte ( 0x40 | rex );
+	opcode ( op );
+	if ( m.index < 0 && (m.base & 7) != RSP )
+		byte ( 0x80 | (reg & 7) << 3 | (m.base & 7) );
+	else
+	{
+		byte ( 0x80 | (reg & 7) << 3 | RSP );
+		byte ( (m.index < 0? RSP: m.index & 7) << 3 | (m.base & 7) );
+	}
+	dword ( m.disp );
+}
+
+// Instruction with register operands
+inline void qjit::op_r ( unsigned pfx, bool w, unsigned op, int reg, int rm )
+{
+	if ( pfx ) byte ( pfx );
+	const unsigned rex = (w? 8: 0) | (reg & 8? 4: 0) | (rm & 8? 1: 0);
+	if ( rex ) byte ( 0x40 | rex );
+	opcode ( op );
+	byte ( 0xc0 | (reg & 7) << 3 | (rm & 7) );
+}
+
+// Jumps whose targets are patched in later; they return the place to patch
+inline size_t qjit::jcc ( int cc )
+{
+	byte ( 0x0f ); byte ( 0x80 | cc );
+	dword ( 0 );
+	return m_buf.size() - 4;
+}
+
+inline size_t qjit::jmp ( void )
+{
+	byte ( 0xe9 );
+	dword ( 0 );
+	return m_buf.size() - 4;
+}
+
+inline void qjit::patch ( size_t at, size_t to )
+{
+	const unsigned rel = to - (at + 4);
+	memcpy ( &m_buf[at], &rel, 4 );
+}
+
+// Leave native code, before the current quad does anything, if cc holds
+inline void qjit::bail_if ( int cc )
+{
+	m_bails.push_back ( bail_ref ( jcc ( cc ), m_cur, m_frame ) );
+}
+
+// ... at quad pc, when the slots are in emulated memory already
+inline void qjit::bail_plain_if ( int cc, size_t pc )
+{
+	m_bails.push_back ( bail_ref ( jcc ( cc ), pc, -1 ) );
+}
+
+// A jump to a quad; leaving the program from a body writes back its slots
+inline void qjit::jump_to ( size_t at, short target )
+{
+	if ( m_frame >= 0 && size_t ( target ) >= m_qlist.size() )
+		m_bails.push_back ( bail_ref ( at, m_qlist.size(), m_frame ) );
+	else
+		m_jumps.push_back ( make_pair ( at, size_t ( target ) ) );
+}
+
+inline void qjit::check_even ( int r )
+{
+	op_r ( 0, false, 0xf7, 0, r ); dword ( 1 ); // test r, 1
+	bail_if ( CC_NE );
+}
+
+// In a body, a computed address r of a datum width bytes wide must not
+// overlap the slots in registers
+inline void qjit::check_alias ( int r, int width )
+{
+	const qframe_type &f = m_frames.frame ( m_frame );
+	op_r ( 0, false, 0x89, r, RDI );				// mov edi, r
+	op_r ( 0, false, 0x29, R13, RDI );			// sub edi, r13d
+	op_r ( 0, false, 0x81, 5, RDI ); dword ( f.lo - width + 1 );	// sub
+	op_r ( 0, false, 0x81, 7, RDI ); dword ( f.hi - f.lo + width - 1 );
+	bail_if ( CC_B );
+}
+
+// The register of a slot in a register, or -1
+inline int qjit::preg ( const opval &v, int m ) const
+{
+	if ( m_frame < 0 || (m != AM_REL && m != AM_RELIND) ) return -1;
+	const vector<short> &slots = m_frames.frame ( m_frame ).slots;
+	for ( size_t k = 0; k < slots.size(); ++k )
+		if ( slots[k] == v.s ) return R8 + k;
+	return -1;
+}
+
+inline void qjit::spill ( int f )
+{
+	const vector<short> &slots = m_frames.frame ( f ).slots;
+	for ( size_t k = 0; k < slots.size(); ++k )
+		op_m ( 0x66, false, 0x89, R8 + k, mref ( RBX, R13, slots[k] ) );
+}
+
+inline void qjit::reload ( int f )
+{
+	const vector<short> &slots = m_frames.frame ( f ).slots;
+	for ( size_t k = 0; k < slots.size(); ++k )
+		op_m ( 0, false, 0x0fb7, R8 + k, mref ( RBX, R13, slots[k] ) );
+}
+
+// Before the slots of frame f go into registers, at quad pc: they must
+// lie above the absolute operands of the body and the stack top, and
+// not wrap around
+inline void qjit::check_frame ( int f, size_t pc )
+{
+	const qframe_type &fr = m_frames.frame ( f );
+	op_m ( 0, false, 0x8d, RAX, mref ( R13, -1, fr.lo ) );	// lea
+	op_r ( 0, false, 0x81, 7, RAX ); dword ( fr.dirend );	// cmp
+	bail_plain_if ( CC_L, pc );
+	op_r ( 0, false, 0x39, RAX, R12 );			// cmp r12d, eax
+	bail_plain_if ( CC_A, pc );
+	op_m ( 0, false, 0x8d, RAX, mref ( R13, -1, fr.hi ) );	// lea
+	op_r ( 0, false, 0x81, 7, RAX ); dword ( 0x10000 );	// cmp
+	bail_plain_if ( CC_G, pc );
+}
+
+// The emulated memory operand for an l-value mode, using register r for
+// a computed address.  A computed (indirect) address of a datum wider
+// than a byte must be even.
+inline qjit::mref qjit::addr ( int r, const opval &v, int m, int width )
+{
+	switch ( m )
+	{
+	case AM_IND:
+		op_m ( 0, false, 0x0fb7, r, mref ( RBX, -1, v.a ) ); // movzx
+		break;
+	case AM_REL:
+	case AM_RELIND:
+		if ( m == AM_RELIND && preg ( v, m ) >= 0 )
+		{
+			op_r ( 0, false, 0x0fb7, r, preg ( v, m ) );	// movzx
+			break;
+		}
+		op_m ( 0, false, 0x8d, r, mref ( R13, -1, v.s ) );	// lea
+		op_r ( 0, false, 0x0fb7, r, r );			// movzx
+		if ( m == AM_REL ) return mref ( RBX, r, 0 );
+		op_m ( 0, false, 0x0fb7, r, mref ( RBX, r, 0 ) );
+		break;
+	default:
+		return mref ( RBX, -1, v.a );
+	}
+	if ( width > 1 ) check_even ( r );
+	if ( m_frame >= 0 ) check_alias ( r, width );
+	return mref ( RBX, r, 0 );
+}
+
+// The destination of a short
+inline qjit::lval qjit::dest ( int r, const opval &v, int m )
+{
+	const int reg = preg ( v, m );
+	if ( m == AM_REL && reg >= 0 ) return lval ( reg, mref ( RBX, -1, 0 ) );
+	return lval ( -1, addr ( r, v, m, 2 ) );
+}
+
+inline void qjit::store16 ( int r, const lval &dst )
+{
+	if ( dst.reg >= 0 ) op_r ( 0, false, 0x0fb7, dst.reg, r );	// movzx
+	else op_m ( 0x66, false, 0x89, r, dst.m );
+}
+
+// Operand values, into 32-bit register r (sign-extended shorts, chars in
+// the low byte, zero-extended addresses) or xmm register x
+inline void qjit::sval ( int r, const opval &v, int m )
+{
+	switch ( m )
+	{
+	case AM_IMM:
+		if ( r >= 8 ) byte ( 0x41 );
+		byte ( 0xb8 + (r & 7) ); dword ( int ( v.s ) );
+		break;
+	case AM_RELIMM:
+		op_m ( 0, false, 0x8d, r, mref ( R13, -1, v.s ) );	// lea
+		op_r ( 0, false, 0x0fbf, r, r );			// movsx
+		break;
+	default:
+		if ( m == AM_REL && preg ( v, m ) >= 0 )
+			op_r ( 0, false, 0x0fbf, r, preg ( v, m ) );	// movsx
+		else
+			op_m ( 0, false, 0x0fbf, r, addr ( r, v, m, 2 ) );
+	}
+}
+
+inline void qjit::cval ( int r, const opval &v, int m )
+{
+	switch ( m )
+	{
+	case AM_IMM:
+		if ( r >= 8 ) byte ( 0x41 );
+		byte ( 0xb8 + (r & 7) ); dword ( int ( v.s ) );
+		break;
+	case AM_RELIMM:
+		op_m ( 0, false, 0x8d, r, mref ( R13, -1, v.s ) );	// lea
+		break;
+	default:
+		op_m ( 0, false, 0x0fb6, r, addr ( r, v, m, 1 ) );	// movzx
+	}
+}
+
+inline void qjit::aval ( int r, const opval &v, int m )
+{
+	switch ( m )
+	{
+	case AM_IMM:
+		if ( r >= 8 ) byte ( 0x41 );
+		byte ( 0xb8 + (r & 7) ); dword ( v.a );
+		break;
+	case AM_RELIMM:
+		op_m ( 0, false, 0x8d, r, mref ( R13, -1, v.s ) );	// lea
+		op_r ( 0, false, 0x0fb7, r, r );			// movzx
+		break;
+	default:
+		if ( m == AM_REL && preg ( v, m ) >= 0 )
+			op_r ( 0, false, 0x0fb7, r, preg ( v, m ) );	// movzx
+		else
+			op_m ( 0, false, 0x0fb7, r, addr ( r, v, m, 2 ) );
+	}
+}
+
+inline void qjit::fval ( int x, const opval &v, int m, int r )
+{
+	if ( m == AM_IMM )
+	{
+		unsigned bits;
+		memcpy ( &bits, &v.f, sizeof(bits) );
+		if ( r >= 8 ) byte ( 0x41 );
+		byte ( 0xb8 + (r & 7) ); dword ( bits );
+		op_r ( 0x66, false, 0x0f6e, x, r );			// movd
+	}
+	else
+		op_m ( 0xf3, false, 0x0f10, x, addr ( r, v, m, 4 ) );	// movss
+}
+
+// Leave native code at quad i, for the threaded engine to run it
+inline void qjit::bail ( size_t i )
+{
+	op_m ( 0, false, 0xc7, 0, reg_field ( offsetof ( jit_regs, pc ) ) );
+	dword ( i );
+	byte ( 0xb8 ); dword ( 1 );					// mov eax, 1
+	m_exits.push_back ( jmp() );
+}
+
+inline bool qjit::go ( void )
+{
+	const size_t nquads = m_qlist.size();
+	const size_t top_off = (const char *)m_mem.TopReg() - (const char *)&m_mem;
+	const size_t link_off =
+		(const char *)m_mem.LinkReg() - (const char *)&m_mem;
+	m_table.resize ( nquads + 1 );
+	if ( m_regs_on ) m_frames.go();
+
+	// Prologue: save registers, keep the stack aligned for calls, and
+	// load rbx = emulated memory, r15 = storage object, r14 = table of
+	// quads, rbp = regs, r12 = stack top, r13 = dynamic link
+	const int saved[] = { RBX, RBP, R12, R13, R14, R15 };
+	for ( int k = 0; k < 6; ++k )
+	{
+		if ( saved[k] >= 8 ) byte ( 0x41 );
+		byte ( 0x50 + (saved[k] & 7) );
+	}
+	op_r ( 0, true, 0x83, 5, RSP ); byte ( 8 );		// sub rsp, 8
+	byte ( 0x48 ); byte ( 0xb8 + RBX );
+	qword ( (unsigned long long)m_mem.Image() );
+	byte ( 0x49 ); byte ( 0xb8 + (R15 & 7) );
+	qword ( (unsigned long long)&m_mem );
+	byte ( 0x49 ); byte ( 0xb8 + (R14 & 7) );
+	qword ( (unsigned long long)&m_table[0] );
+	byte ( 0x48 ); byte ( 0xb8 + RBP );
+	qword ( (unsigned long long)&m_regs );
+	op_m ( 0, false, 0x0fb7, R12, field ( top_off ) );
+	op_m ( 0, false, 0x0fb7, R13, field ( link_off ) );
+	// Start at the quad in regs: mov edx, pc; jmp [r14+rdx*8]
+	op_m ( 0, false, 0x8b, RDX, reg_field ( offsetof ( jit_regs, pc ) ) );
+	byte ( 0x41 ); byte ( 0xff ); byte ( 0x24 ); byte ( 0xd6 );
+
+	// The quads, and the end marker
+	m_start.resize ( nquads + 1 );
+	for ( m_cur = 0; m_cur < nquads; ++m_cur )
+	{
+		m_start[m_cur] = m_buf.size();
+		m_frame = m_regs_on? m_frames.body ( m_cur ): -1;
+		if ( m_profile && m_profile->leader ( m_cur ) )
+		{
+			// add qword [counts + 8*i], 1
+			op_m ( 0, true, 0x8b, RAX,
+				reg_field ( offsetof ( jit_regs, counts ) ) );
+			op_m ( 0, true, 0x83, 0, mref ( RAX, -1, m_cur * 8 ) );
+			byte ( 1 );
+		}
+		const size_t body = m_buf.size(), jumps = m_jumps.size(),
+			bails = m_bails.size(), exits = m_exits.size();
+		if ( !quad ( m_cur ) )
+		{
+			// No template: discard what was emitted
+			m_buf.resize ( body );
+			m_jumps.resize ( jumps );
+			m_bails.erase ( m_bails.begin() + bails, m_bails.end() );
+			m_exits.resize ( exits );
+			if ( m_frame >= 0 ) spill ( m_frame );
+			bail ( m_cur );
+		}
+	}
+	if ( m_frame >= 0 )
+	{
+		// Running off the end of a body
+		spill ( m_frame );
+		bail ( nquads );
+	}
+	m_frame = -1;
+	m_start[nquads] = m_buf.size();
+	bail ( nquads );
+
+	// Ways back into bodies from elsewhere (returns from calls): load the
+	// slots and carry on
+	vector<size_t> entry ( nquads, 0 );
+	for ( m_cur = 0; m_regs_on && m_cur < nquads; ++m_cur )
+	{
+		const int f = m_frames.body ( m_cur );
+		if ( f < 0 ) continue;
+		entry[m_cur] = m_buf.size();
+		check_frame ( f, m_cur );
+		reload ( f );
+		m_jumps.push_back ( make_pair ( jmp(), m_cur ) );
+	}
+
+	// Exits from quads that must not run natively
+	map< pair<size_t, int>, size_t > stub;
+	for ( size_t k = 0; k < m_bails.size(); ++k )
+	{
+		const bail_ref &b = m_bails[k];
+		size_t &to = stub[make_pair ( b.pc, b.frame )];
+		if ( !to )
+		{
+			to = m_buf.size();
+			if ( b.frame >= 0 ) spill ( b.frame );
+			bail ( b.pc );
+		}
+		patch ( b.at, to );
+	}
+
+	// Epilogue: store the stack registers back
+	const size_t epilogue = m_buf.size();
+	op_m ( 0x66, false, 0x89, R12, field ( top_off ) );
+	op_m ( 0x66, false, 0x89, R13, field ( link_off ) );
+	op_r ( 0, true, 0x83, 0, RSP ); byte ( 8 );		// add rsp, 8
+	for ( int k = 5; k >= 0; --k )
+	{
+		if ( saved[k] >= 8 ) byte ( 0x41 );
+		byte ( 0x58 + (saved[k] & 7) );
+	}
+	byte ( 0xc3 );							// ret
+
+	for ( size_t k = 0; k < m_jumps.size(); ++k )
+		patch ( m_jumps[k].first, m_start[m_jumps[k].second] );
+	for ( size_t k = 0; k < m_exits.size(); ++k )
+		patch ( m_exits[k], epilogue );
+
+	// Copy into executable memory
+	m_size = m_buf.size();
+	void *p = mmap ( 0, m_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if ( p == MAP_FAILED ) return false;
+	memcpy ( p, &m_buf[0], m_size );
+	if ( mprotect ( p, m_size, PROT_READ | PROT_EXEC ) != 0 )
+	{
+		munmap ( p, m_size );
+		return false;
+	}
+	m_native = p;
+	for ( size_t i = 0; i <= nquads; ++i )
+		m_table[i] = (const char *)p
+			+ (i < nquads && entry[i]? entry[i]: m_start[i]);
+	vector<unsigned char>().swap ( m_buf );
+	return true;
+}
+
+inline int qjit::run ( size_t pc, adr_type gsize, bool running )
+{
+	m_regs.gsize = gsize;
+	m_regs.running = running;
+	m_regs.pc = pc;
+	m_regs.counts = m_profile? m_profile->counts(): 0;
+	return ((int (*)( void ))m_native)();
+}
+
+// Translate quad i.  Registers: eax, ecx, edx, esi, edi and xmm0, xmm1
+// are scratch; r12d and r13d hold the stack top and dynamic link, and
+// r8d..r11d slots of the frame in a body.
+inline bool qjit::quad ( size_t i )
+{
+	const dquad_type &d = m_code[i];
+	const char op = m_qlist[i].op();
+
+	switch ( op )
+	{
+	// 3 address quads
+	case 'a': case 's': case 'm': case 'd': case 'r': case '|': case '&':
+	{
+		if ( d.m3 >= AM_LVALS ) return false;
+		const lval dst = dest ( RSI, d.v3, d.m3 );
+		sval ( RAX, d.v1, d.m1 );
+		sval ( RCX, d.v2, d.m2 );
+		switch ( op )
+		{
+		case 'a': op_r ( 0, false, 0x01, RCX, RAX ); break;
+		case 's': op_r ( 0, false, 0x29, RCX, RAX ); break;
+		case 'm': op_r ( 0, false, 0x0faf, RAX, RCX ); break;
+		case '|': op_r ( 0, false, 0x09, RCX, RAX ); break;
+		case '&': op_r ( 0, false, 0x21, RCX, RAX ); break;
+		case 'd': case 'r':
+			op_r ( 0, false, 0x85, RCX, RCX );		// test ecx, ecx
+			bail_if ( CC_E );
+			byte ( 0x99 );					// cdq
+			op_r ( 0, false, 0xf7, 7, RCX );		// idiv ecx
+			if ( op == 'r' ) op_r ( 0, false, 0x89, RDX, RAX );
+			break;
+		}
+		store16 ( RAX, dst );
+		return true;
+	}
+	case 'A': case 'S': case 'M': case 'D':
+	{
+		if ( d.m1 >= AM_FLOATS || d.m2 >= AM_FLOATS || d.m3 >= AM_LVALS )
+			return false;
+		const mref dst = addr ( RSI, d.v3, d.m3, 4 );
+		fval ( 0, d.v1, d.m1, RAX );
+		fval ( 1, d.v2, d.m2, RCX );
+		const unsigned sse = op == 'A'? 0x0f58: op == 'S'? 0x0f5c:
+			op == 'M'? 0x0f59: 0x0f5e;
+		op_r ( 0xf3, false, sse, 0, 1 );
+		op_m ( 0xf3, false, 0x0f11, 0, dst );			// movss
+		return true;
+	}
+
+	// Conditional branches
+	case 'l': case 'g': case 'e':
+		sval ( RAX, d.v1, d.m1 );
+		sval ( RCX, d.v2, d.m2 );
+		op_r ( 0, false, 0x39, RCX, RAX );			// cmp eax, ecx
+		jump_to ( jcc ( op == 'l'? CC_L: op == 'g'? CC_G: CC_E ), d.v3.s );
+		return true;
+	case 'L': case 'G': case 'E':
+		if ( d.m1 >= AM_FLOATS || d.m2 >= AM_FLOATS ) return false;
+		fval ( 0, d.v1, d.m1, RAX );
+		fval ( 1, d.v2, d.m2, RCX );
+		// Taken only if ordered, as C++ comparisons are
+		if ( op == 'L' ) op_r ( 0, false, 0x0f2e, 1, 0 );	// ucomiss y, x
+		else op_r ( 0, false, 0x0f2e, 0, 1 );			// ucomiss x, y
+		if ( op == 'E' )
+		{
+			byte ( 0x7a ); byte ( 6 );			// jp over je
+			jump_to ( jcc ( CC_E ), d.v3.s );
+		}
+		else
+			jump_to ( jcc ( CC_A ), d.v3.s );
+		return true;
+
+	// 2 address quads
+	case 'i': case '~': case 'n':
+	{
+		if ( d.m2 >= AM_LVALS ) return false;
+		const lval dst = dest ( RSI, d.v2, d.m2 );
+		sval ( RAX, d.v1, d.m1 );
+		if ( op == '~' ) op_r ( 0, false, 0xf7, 2, RAX );	// not
+		if ( op == 'n' ) op_r ( 0, false, 0xf7, 3, RAX );	// neg
+		store16 ( RAX, dst );
+		return true;
+	}
+	case '=':
+	{
+		if ( d.m2 >= AM_LVALS ) return false;
+		const mref dst = addr ( RSI, d.v2, d.m2, 1 );
+		cval ( RAX, d.v1, d.m1 );
+		op_m ( 0, false, 0x88, RAX, dst );
+		return true;
+	}
+	case 'I': case 'N':
+	{
+		if ( d.m1 >= AM_FLOATS || d.m2 >= AM_LVALS ) return false;
+		const mref dst = addr ( RSI, d.v2, d.m2, 4 );
+		fval ( 0, d.v1, d.m1, RAX );
+		if ( op == 'N' )
+		{
+			op_r ( 0x66, false, 0x0f7e, 0, RAX );		// movd eax, xmm0
+			op_r ( 0, false, 0x81, 6, RAX ); dword ( 0x80000000 ); // xor
+			op_r ( 0x66, false, 0x0f6e, 0, RAX );		// movd xmm0, eax
+		}
+		op_m ( 0xf3, false, 0x0f11, 0, dst );			// movss
+		return true;
+	}
+	case 'F':
+	{
+		if ( d.m2 >= AM_LVALS ) return false;
+		const mref dst = addr ( RSI, d.v2, d.m2, 4 );
+		sval ( RAX, d.v1, d.m1 );
+		op_r ( 0xf3, false, 0x0f2a, 0, RAX );			// cvtsi2ss
+		op_m ( 0xf3, false, 0x0f11, 0, dst );			// movss
+		return true;
+	}
+	case 'f':
+	{
+		if ( d.m1 >= AM_FLOATS || d.m2 >= AM_LVALS ) return false;
+		const lval dst = dest ( RSI, d.v2, d.m2 );
+		fval ( 0, d.v1, d.m1, RAX );
+		op_r ( 0xf3, false, 0x0f2c, RAX, 0 );			// cvttss2si
+		store16 ( RAX, dst );
+		return true;
+	}
+
+	// Function call
+	case 'c':
+		if ( d.v2.s < 0 )
+		{
+			int (*io)( storage_type * ) = 0;
+			switch ( d.v2.s )
+			{
+			case -1: io = native_pseudo<-1>; break;
+			case -2: io = native_pseudo<-2>; break;
+			case -3: io = native_pseudo<-3>; break;
+			case -4: io = native_pseudo<-4>; break;
+			case -5: io = native_pseudo<-5>; break;
+			case -9: io = native_pseudo<-9>; break;
+			case -10: io = native_pseudo<-10>; break;
+			case -11: io = native_pseudo<-11>; break;
+			case -12: io = native_pseudo<-12>; break;
+			case -13: io = native_pseudo<-13>; break;
+			default: return false;
+			}
+			const size_t top_off =
+				(const char *)m_mem.TopReg() - (const char *)&m_mem;
+			// The helper sees the slots in memory, and may change them
+			if ( m_frame >= 0 ) spill ( m_frame );
+			op_m ( 0x66, false, 0x89, R12, field ( top_off ) );
+			op_r ( 0, true, 0x89, R15, RDI );		// mov rdi, r15
+			byte ( 0x48 ); byte ( 0xb8 );			// mov rax, io
+			qword ( (unsigned long long)io );
+			byte ( 0xff ); byte ( 0xd0 );			// call rax
+			op_r ( 0, false, 0x85, RAX, RAX );		// test eax, eax
+			bail_plain_if ( CC_NE, i );
+			if ( m_frame >= 0 ) reload ( m_frame );
+			return true;
+		}
+		if ( m_frame >= 0 ) spill ( m_frame );
+		// push result address and return address
+		aval ( RDX, d.v1, d.m1 );
+		op_m ( 0, false, 0x8d, RAX, mref ( R12, -1, -2 ) );	// lea
+		op_r ( 0, false, 0x0fb7, RAX, RAX );
+		op_m ( 0x66, false, 0x89, RDX, mref ( RBX, RAX, 0 ) );
+		op_m ( 0, false, 0x8d, R12, mref ( RAX, -1, -2 ) );
+		op_r ( 0, false, 0x0fb7, R12, R12 );
+		op_m ( 0x66, false, 0xc7, 0, mref ( RBX, R12, 0 ) );
+		word ( i + 1 );
+		goto_quad ( d.v2.s );
+		return true;
+
+	// Push parameter, checking for stack overflow
+	case 'p': case 'P':
+	{
+		if ( op == 'P' && d.m1 >= AM_FLOATS ) return false;
+		op_m ( 0, false, 0x8d, RAX,
+			mref ( R12, -1, op == 'p'? -2: -4 ) );		// lea
+		op_m ( 0, false, 0x3b, RAX,
+			reg_field ( offsetof ( jit_regs, gsize ) ) );	// cmp
+		bail_if ( CC_L );
+		if ( op == 'p' ) aval ( RDX, d.v1, d.m1 );
+		else fval ( 0, d.v1, d.m1, RDX );
+		op_r ( 0, false, 0x89, RAX, R12 );			// mov r12d, eax
+		if ( op == 'p' ) op_m ( 0x66, false, 0x89, RDX, mref ( RBX, R12, 0 ) );
+		else op_m ( 0xf3, false, 0x0f11, 0, mref ( RBX, R12, 0 ) );
+		return true;
+	}
+
+	// Create stack frame: push the link, link to it, reserve locals
+	case '#':
+		op_m ( 0, false, 0x8d, R12, mref ( R12, -1, -2 ) );
+		op_r ( 0, false, 0x0fb7, R12, R12 );
+		op_m ( 0x66, false, 0x89, R13, mref ( RBX, R12, 0 ) );
+		op_r ( 0, false, 0x89, R12, R13 );			// mov r13d, r12d
+		op_m ( 0, false, 0x8d, R12, mref ( R12, -1, -d.v1.s ) );
+		op_r ( 0, false, 0x0fb7, R12, R12 );
+		if ( m_regs_on && m_frames.entry ( i ) >= 0 )
+		{
+			check_frame ( m_frames.entry ( i ), i + 1 );
+			reload ( m_frames.entry ( i ) );
+		}
+		return true;
+
+	// Pop runtime stack; in a body, not above the slots in registers
+	case '^':
+		if ( d.v1.s & 1 ) return false;
+		if ( m_frame >= 0 )
+		{
+			op_m ( 0, false, 0x8d, RAX, mref ( R12, -1, d.v1.s ) );
+			op_r ( 0, false, 0x0fb7, RAX, RAX );
+			op_m ( 0, false, 0x8d, RCX,
+				mref ( R13, -1, m_frames.frame ( m_frame ).lo ) );
+			op_r ( 0, false, 0x39, RCX, RAX );		// cmp eax, ecx
+			bail_if ( CC_A );
+		}
+		op_m ( 0, false, 0x8d, R12, mref ( R12, -1, d.v1.s ) );
+		op_r ( 0, false, 0x0fb7, R12, R12 );
+		return true;
+
+	// Return: the restored link must be even
+	case '/':
+		if ( m_frame >= 0 ) spill ( m_frame );
+		op_r ( 0, false, 0x89, R13, RAX );			// mov eax, r13d
+		op_m ( 0, false, 0x0fb7, RCX, mref ( RBX, RAX, 0 ) );
+		check_even ( RCX );
+		op_m ( 0, false, 0x8d, RDX, mref ( RAX, -1, 2 ) );
+		op_r ( 0, false, 0x0fb7, RDX, RDX );
+		op_m ( 0, false, 0x0fb7, RDX, mref ( RBX, RDX, 0 ) );
+		op_m ( 0, false, 0x8d, R12, mref ( RAX, -1, 6 ) );
+		op_r ( 0, false, 0x0fb7, R12, R12 );
+		op_r ( 0, false, 0x89, RCX, R13 );			// mov r13d, ecx
+		op_r ( 0, false, 0x81, 7, RDX ); dword ( m_qlist.size() ); // cmp
+		byte ( 0x76 ); byte ( 5 );				// jbe
+		byte ( 0xb8 + RDX ); dword ( m_qlist.size() );	// mov edx, n
+		byte ( 0x41 ); byte ( 0xff ); byte ( 0x24 ); byte ( 0xd6 );
+		return true;						// jmp [r14+rdx*8]
+
+	case '$':
+		op_m ( 0, false, 0x81, 7,
+			reg_field ( offsetof ( jit_regs, running ) ) ); dword ( 0 );
+		bail_if ( CC_NE );
+		op_m ( 0, false, 0xc7, 0,
+			reg_field ( offsetof ( jit_regs, running ) ) ); dword ( 1 );
+		op_m ( 0, false, 0xc7, 0,
+			reg_field ( offsetof ( jit_regs, gsize ) ) );
+		dword ( adr_type ( d.v2.s ) );
+		goto_quad ( d.v1.s );
+		return true;
+	case 'j':
+		goto_quad ( d.v1.s );
+		return true;
+	case 'h':
+		if ( m_frame >= 0 ) spill ( m_frame );
+		op_r ( 0, false, 0x31, RAX, RAX );			// xor eax, eax
+		m_exits.push_back ( jmp() );
+		return true;
+	case ';':
+		return true;
+
+	// Block and vector quads, through a helper that does them in C++
+	case 'b': case 'w': case 'W': case 'v': case 'V': case 'u': case 'U':
+	case 't': case 'T':
+	{
+		int (*block)( storage_type *, const dquad_type * ) = 0;
+		switch ( op )
+		{
+		case 'b': block = native_block<'b'>; break;
+		case 'w': block = native_block<'w'>; break;
+		case 'W': block = native_block<'W'>; break;
+		case 'v': block = native_block<'v'>; break;
+		case 'V': block = native_block<'V'>; break;
+		case 'u': block = native_block<'u'>; break;
+		case 'U': block = native_block<'U'>; break;
+		case 't': block = native_block<'t'>; break;
+		case 'T': block = native_block<'T'>; break;
+		}
+		const size_t top_off =
+			(const char *)m_mem.TopReg() - (const char *)&m_mem;
+		const size_t link_off =
+			(const char *)m_mem.LinkReg() - (const char *)&m_mem;
+		// The helper reads base-relative operands through the link, and
+		// its blocks may take in the slots
+		if ( m_frame >= 0 ) spill ( m_frame );
+		op_m ( 0x66, false, 0x89, R12, field ( top_off ) );
+		op_m ( 0x66, false, 0x89, R13, field ( link_off ) );
+		op_r ( 0, true, 0x89, R15, RDI );		// mov rdi, r15
+		byte ( 0x48 ); byte ( 0xbe );			// mov rsi, &d
+		qword ( (unsigned long long)&d );
+		byte ( 0x48 ); byte ( 0xb8 );			// mov rax, block
+		qword ( (unsigned long long)block );
+		byte ( 0xff ); byte ( 0xd0 );			// call rax
+		op_r ( 0, false, 0x85, RAX, RAX );		// test eax, eax
+		bail_plain_if ( CC_NE, i );
+		if ( m_frame >= 0 ) reload ( m_frame );
+		return true;
+	}
+	}
+
+	return false;
+}
+
+#endif // HAVE_JIT
+
+#endif // JIT_H
@@ -0,0 +1,196 @@
+// libvmq.cpp
+// Embedding interface to the Compiler Theory Class interpreter (see
+// libvmq.h)
+
+#define VERSION "2.04"	// as vmq.cpp
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+
+#include "libvmq.h"
+#include "storage.h"
+#include "quad.h"
+#include "output.h"
+#include "input.h"
+#include "verify.h"
+#include "qobject.h"
+#include "mapfile.h"
+#include "loader.h"
+#include "interp.h"
+#include "snapshot.h"
+
+using namespace std;
+
+// Output written by the program a thread runs, and input it reads
+thread_local out_buffer qout;
+thread_local in_scanner qin;
+
+namespace vmq
+{
+
+struct Program::impl
+{
+	impl ( void ): mem(MEM_DEFAULT), ok(false), verified(false) {}
+	void clear ( void );
+	int done ( int level );
+
+	storage_type mem;	// as loaded
+	quad_list qlist;
+	bool ok;		// loaded without errors
+	bool verified;		// may run on the threaded engine
+	ostringstream err;
+	string messages;
+};
+
+// Start loading afresh
+void Program::impl::clear ( void )
+{
+	qlist.clear();
+	memset ( mem.Image(), 0, mem.Extent() );
+	ok = verified = false;
+	err.str ( "" );
+}
+
+// Finish loading with errors of the given level
+int Program::impl::done ( int level )
+{
+	ok = level <= ERR_WARN;
+	if ( ok )
+	{
+		verified = qverifier ( qlist, mem, err ).go();
+		if ( !verified )
+			err << "Program not verified; running with all checks" << endl;
+	}
+	messages = err.str();
+	return level;
+}
+
+Program::Program ( void ): m_impl ( new impl ) {}
+
+Program::~Program () { delete m_impl; }
+
+// As vmq loads a file: a quad object file, or the quad object file made
+// from this version of a .q file, or the .q file itself
+int Program::load ( const char *fname )
+{
+	impl &p = *m_impl;
+	p.clear();
+	mapped_file qf;
+	if ( !qf.open ( fname ) )
+	{
+		p.err << "Can't open file " << fname << ": " << strerror(errno)
+			<< endl;
+		p.messages = p.err.str();
+		return ERR_ERROR;
+	}
+
+	mapped_file cache;
+	qbreader reader ( p.mem, p.qlist );
+	if ( reader.go ( qf.data(), qf.size() )
+		|| ( cache.open ( qobj_cachename ( fname ).c_str() )
+			&& reader.go ( cache.data(), cache.size(),
+				qf.data(), qf.size() ) ) )
+		return p.done ( 0 );
+	return parse ( qf.data(), qf.size() );
+}
+
+int Program::parse ( const char *text, size_t n )
+{
+	impl &p = *m_impl;
+	p.clear();
+	qfreader loader ( text, n, p.mem, p.qlist, p.err );
+	return p.done ( loader.go() );
+}
+
+bool Program::loaded ( void ) const { return m_impl->ok; }
+
+size_t Program::size ( void ) const { return m_impl->qlist.size(); }
+
+const string &Program::messages ( void ) const { return m_impl->messages; }
+
+struct Machine::impl
+{
+	impl ( const Program::impl &p, int engine )
+		: program(p), mem(p.mem.Size()), out(&trace),
+		  machine(mem, p.qlist, (engine & SWITCH) || !p.verified,
+			!(engine & NOJIT), 0, !(engine & NOREGS), 0, out, err),
+		  write(0), wctx(0), read(0), rctx(0), text(0), textlen(0) {}
+
+	const Program::impl &program;
+	storage_type mem;
+	qout_streambuf trace;	// traces and dumps go with the output
+	ostream out;
+	ostringstream err;
+	interpreter machine;
+	qsnapshot snap;		// where runs start, once taken
+
+	write_fn write;
+	void *wctx;
+	read_fn read;
+	void *rctx;
+	const char *text;	// input for every run, if not 0
+	size_t textlen;
+	string messages;
+};
+
+Machine::Machine ( const Program &program, int engine )
+	: m_impl ( new impl ( *program.m_impl, engine ) ) {}
+
+Machine::~Machine () { delete m_impl; }
+
+void Machine::output ( write_fn f, void *ctx )
+{
+	m_impl->write = f;
+	m_impl->wctx = ctx;
+}
+
+void Machine::input ( read_fn f, void *ctx )
+{
+	m_impl->read = f;
+	m_impl->rctx = ctx;
+	m_impl->text = 0;
+}
+
+void Machine::input ( const char *text, size_t n )
+{
+	m_impl->text = text;
+	m_impl->textlen = n;
+}
+
+int Machine::run ( void )
+{
+	impl &m = *m_impl;
+	m.err.str ( "" );
+	if ( !m.program.ok )
+	{
+		m.messages = "No program loaded\n";
+		return ERR_ERROR;
+	}
+	m.mem.Copy ( m.program.mem );
+
+	// This thread's program I/O is the machine's while it runs
+	qout.sink ( m.write, m.wctx );
+	if ( m.text )
+		qin.text ( m.text, m.textlen );
+	else
+		qin.source ( m.read, m.rctx );
+	int level;
+	if ( m.snap.taken() )
+		level = m.machine.go ( m.snap );
+	else
+	{
+		level = m.machine.snapshot ( m.snap );
+		if ( m.snap.taken() ) level = m.machine.go ( m.snap );
+	}
+	qout.sink ( 0, 0 );
+	m.messages = m.err.str();
+	return level;
+}
+
+const string &Machine::messages ( void ) const { return m_impl->messages; }
+
+} // namespace vmq
@@ -0,0 +1,105 @@
+// libvmq.h
+// Embedding interface to the Compiler Theory Class interpreter
+
+// A vmq::Program is a quad program, loaded once (from a .q file, a quad
+// object file, or the text of a .q file in memory) and verified.  It does
+// not change once loaded, so any number of vmq::Machines, in any threads,
+// may run it; it must outlive them, and not be loaded again while they
+// exist.
+//
+// A Machine has its own data memory and I/O.  Each run() starts the
+// program afresh, from the data it was loaded with, and returns the level
+// of the worst error, as vmq reports it, instead of ending the process;
+// the error messages are kept for messages().  Decoding and native code
+// are made on the first run and reused.  So is the state of the machine
+// where the program first reads input: later runs start from there,
+// without doing again what it did before it read.  By default a machine
+// reads standard input and writes standard output; callbacks, or text
+// given for every run, take their place.  Traces and dumps go with the
+// output.
+//
+// A thread runs one machine at a time.  Link with libvmq.a, or libvmq.so
+// (-lvmq -ldl).
+
+#ifndef LIBVMQ_H
+#define LIBVMQ_H
+
+#include <cstddef>
+#include <string>
+
+#if defined(__GNUC__)
+#define VMQ_API __attribute__((visibility("default")))
+#else
+#define VMQ_API
+#endif
+
+namespace vmq
+{
+
+// Error levels, as vmq reports them.  A program that loads with errors
+// above WARNING can't run.
+enum { OK = 0, WARNING = 5, ERROR = 10, FATAL = 20 };
+
+// Engines for Machine: by default, native code where it can be made,
+// with the threaded engine for the rest.  A program that fails
+// verification always runs on the fully checked switch engine.
+enum { SWITCH = 1, NOJIT = 2, NOREGS = 4 };
+
+// Output callbacks take what the program writes, in order.  Input
+// callbacks read up to n bytes into buf and return how many, or 0 at the
+// end of the input.
+typedef void (*write_fn) ( void *ctx, const char *data, size_t n );
+typedef long (*read_fn) ( void *ctx, char *buf, size_t n );
+
+class VMQ_API Program
+{
+public:
+	Program ( void );
+	~Program ();
+
+	// Each returns the level of the worst error
+	int load ( const char *fname );	// a .q file or quad object file
+	int parse ( const char *text, size_t n );	// the text of a .q file
+
+	bool loaded ( void ) const;	// and can run
+	size_t size ( void ) const;	// number of quads
+	const std::string &messages ( void ) const;	// of loading
+
+	struct impl;
+
+private:
+	impl *m_impl;
+
+	Program ( const Program & );	// not copied
+	void operator = ( const Program & );
+
+	friend class Machine;
+};
+
+class VMQ_API Machine
+{
+public:
+	explicit Machine ( const Program &program, int engine = 0 );
+	~Machine ();
+
+	// I/O for the runs that follow; a null callback means standard
+	// output or input
+	void output ( write_fn f, void *ctx );
+	void input ( read_fn f, void *ctx );
+	void input ( const char *text, size_t n );	// read by every run
+
+	int run ( void );
+	const std::string &messages ( void ) const;	// of the last run
+
+	struct impl;
+
+private:
+	impl *m_impl;
+
+	Machine ( const Machine & );	// not copied
+	void operator = ( const Machine & );
+};
+
+} // namespace vmq
+
+#endif // LIBVMQ_H
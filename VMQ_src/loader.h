@@ -0,0 +1,462 @@
+// loader.h
+// Quad file reader for the Compiler Theory Class interpreter
+
+// Copyright 2002 Raymond L. Zarling
+
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cctype>
+#include <cstring>
+#include <climits>
+#include <cfloat>
+#include <limits>
+#include <charconv>
+#include "storage.h"
+#include "quad.h"
+
+using namespace std;
+
+// Routines to read a quad file and initialize program and data memory.
+// The reader scans the text of the whole file in place: a line, and a
+// field within it, is a pair of pointers.  Errors are reported on err;
+// go() returns the level of the worst.
+class qfreader
+{
+public:
+	qfreader ( const char *text, size_t size, storage_type &mem,
+		quad_list &qlist, ostream &err = cerr )
+		: m_errorlevel(0), m_lineno(0), m_text(text), m_end(text + size),
+		  m_line(text), m_eol(text), m_mem ( mem ), m_qlist ( qlist ),
+		  m_datasize(0), m_err(err) {}
+	int go ( void );
+	// Size of the part of data memory the data section initialized
+	size_t datasize ( void ) const { return m_datasize; }
+
+private:
+	void posterror ( int level, const string &msg ) const;
+	void initialized ( size_t end );
+	char at ( const char *p ) const { return p < m_eol? *p: '\n'; }
+	void field ( const char *&p, const char *&s, const char *&e ) const;
+	qop parse_adr ( const char *s, const char *e, bool dst, bool flt ) const;
+	qop parse_short ( const char *s, const char *e ) const;
+
+	mutable int m_errorlevel;
+	unsigned m_lineno;
+	const char *m_text, *m_end; // the quad file
+	const char *m_line, *m_eol; // current source line, without its '\n'
+	storage_type &m_mem;
+	quad_list &m_qlist;
+	size_t m_datasize;
+	ostream &m_err;
+};
+
+// Numbers in a quad file are read as stream extraction (>>) read them,
+// but straight from the text, with no stream or string in between.  p
+// is where the number starts and e where its field ends; p is left just
+// after the number.
+
+// Whitespace, as >> skips it
+inline bool white ( char c )
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f'
+		|| c == '\r';
+}
+
+// An integer of type T: a value out of range gives the nearest limit,
+// and no digits give 0
+template <class T>
+inline T get_int ( const char *&p, const char *e )
+{
+	const bool neg = p < e && *p == '-';
+	const char *d = p < e && (*p == '-' || *p == '+')? p + 1: p;
+	unsigned long long m;
+	const from_chars_result r = from_chars ( d, e, m );
+	if ( r.ptr == d ) return 0;
+	p = r.ptr;
+
+	const bool big = r.ec == errc::result_out_of_range;
+	const unsigned long long max = numeric_limits<T>::max();
+	if ( !numeric_limits<T>::is_signed )
+	{
+		if ( big || m > max ) return numeric_limits<T>::max();
+		return neg? T(-m): T(m);
+	}
+	if ( neg )
+		return big || m > max + 1? numeric_limits<T>::min(): T(-(long long)m);
+	return big || m > max? numeric_limits<T>::max(): T(m);
+}
+
+// A float: the longest prefix that looks like a decimal number, which
+// must be a whole one ("1.5e" isn't), or the value is 0
+inline float get_float ( const char *&p, const char *e )
+{
+	const char *q = p;
+	bool digits = false;
+	if ( q < e && (*q == '-' || *q == '+') ) ++q;
+	const char *d = q; // from_chars takes no '+'
+	if ( p < e && *p == '-' ) d = p;
+	for ( ; q < e && isdigit ( *q ); ++q ) digits = true;
+	if ( q < e && *q == '.' )
+		for ( ++q; q < e && isdigit ( *q ); ++q ) digits = true;
+	if ( digits && q < e && (*q == 'e' || *q == 'E') )
+	{
+		++q;
+		if ( q < e && (*q == '-' || *q == '+') ) ++q;
+		while ( q < e && isdigit ( *q ) ) ++q;
+	}
+	if ( !digits ) return 0;
+
+	float f = 0;
+	const from_chars_result r = from_chars ( d, q, f );
+	if ( r.ptr != q ) return 0; // an incomplete exponent
+	p = q;
+	if ( r.ec == errc::result_out_of_range )
+	{
+		// Too large gives the largest float, too small what strtof gives
+		char buf[64];
+		if ( size_t ( q - d ) >= sizeof(buf) ) return 0;
+		memcpy ( buf, d, q - d );
+		buf[q - d] = '\0';
+		f = strtof ( buf, 0 );
+		if ( f > FLT_MAX ) f = FLT_MAX;
+		if ( f < -FLT_MAX ) f = -FLT_MAX;
+	}
+	return f;
+}
+
+inline int qfreader::go ( void )
+{
+	bool datasection = true; /* true while reading static data */
+
+	for ( const char *next = m_text; next < m_end; )
+	{
+		// The next line; the last may have no '\n'
+		m_line = next;
+		m_eol = (const char *)memchr ( m_line, '\n', m_end - m_line );
+		if ( !m_eol ) m_eol = m_end;
+		next = m_eol < m_end? m_eol + 1: m_end;
+		m_lineno++;
+
+		if ( datasection )
+		{	/* use the line contents to initialize some data storage */
+			if ( !isdigit ( at ( m_line ) ) ) /* end of data section? */
+			{
+				datasection = false;
+				// execution will continue with decoding quads below
+			}
+			else // not yet end of datasection
+			{
+				// Get address to load the constant
+				const char *p = m_line;
+				const adr_type a = get_int<adr_type> ( p, m_eol );
+				while ( p < m_eol && white ( *p ) ) ++p;
+				// Discover the type of the constant
+				// Get a pointer to the value
+				const char *space = m_line;
+				while ( space < m_eol && *space != ' ' && *space != '\t' )
+					++space;
+				const char *vptr = space;
+				while ( vptr < m_eol && (*vptr == ' ' || *vptr == '\t') )
+					++vptr;
+				if ( space == m_eol )
+				{
+					posterror ( ERR_ERROR, "No Initialization Value Found" );
+					continue;
+				}
+
+				// interpret type of constant, set memory
+				switch ( at ( vptr ) )
+				{
+				case '\"':	// string constant
+					try
+					{
+						const char *end = (const char *)memchr ( vptr+1, '"',
+							m_eol - (vptr+1) );
+						if ( !end )
+						{
+							posterror ( ERR_WARN, "Unterminated string" );
+							end = m_eol;
+						}
+						m_mem.Set( a, vptr+1, end );
+						// escapes only shorten the string
+						initialized ( a + (end-vptr-1) + 1 );
+					}
+					catch ( runtime_error &e )
+					{
+						posterror ( ERR_ERROR, e.what() );
+					}
+					break;
+
+				case '0': case '1': case '2': case '3': case '4': // numeric
+				case '5': case '6': case '7': case '8': case '9':
+				case '+': case '-': case '.':
+					try
+					{
+						const char *x = vptr;
+						while ( x < m_eol && *x != '.' && *x != ' '
+							&& *x != '\t' )
+							++x;
+						if ( at ( x ) == '.' )
+						{
+							const float f = get_float ( p, m_eol );
+							m_mem.Set ( a, f );
+							initialized ( a + sizeof(f) );
+						}
+						else
+						{
+							const word_type i =
+								get_int<word_type> ( p, m_eol );
+							m_mem.Set ( a, i );
+							initialized ( a + sizeof(i) );
+						}
+					}
+					catch ( runtime_error &e )
+					{
+						posterror ( ERR_ERROR, e.what() );
+					}
+					break;
+
+				default:
+					posterror ( ERR_ERROR, "Unrecognized data type" );
+				} // switch
+				continue; // Get the next line
+			} // end "else" clause (not end of datasection)
+		} // if datasection
+
+		// Control continues here if we are no longer in datasection, or
+		// if the datasection code discovered the code section.
+
+		// We cannot handle more than QUAD_MAX quads, because
+		// signed label_type ints are used to address them.
+		if ( m_qlist.size() >= QUAD_MAX )
+		{
+			posterror ( ERR_FATAL, "Too many quads" );
+			return m_errorlevel;
+		}
+
+		// Parse the line and fill in a quad structure
+		const char *p = m_line;
+		bool traceon = false, traceoff = false, dump = false;
+
+		// Look for debugging flags
+		if ( at ( p ) == 'x' )
+		{
+			++p; traceon = true;
+		}
+		if ( at ( p ) == 'X' )
+		{
+			++p; traceoff = true;
+		}
+		if ( at ( p ) == '@' )
+		{
+			++p; dump = true;
+		}
+
+		const char sop = at ( p++ );
+		// fields of the quad: operand n is s[n] up to e[n]
+		const char *s[4], *e[4];
+		const bool f = false, t = true; // notational convenience
+		bool r = isupper(sop); // is current operand a "real"; i.e. float
+
+		switch ( sop )
+		{
+		// 3 address quads
+		case 'a': case 'A': case 's': case 'S': case 'm': case 'M':
+		case 'd': case 'D': case 'r': case '|': case '&':
+			field ( p, s[1], e[1] ); field ( p, s[2], e[2] );
+			field ( p, s[3], e[3] );
+			m_qlist.push_back ( quad_type( sop, parse_adr(s[1],e[1],f,r),
+				parse_adr(s[2],e[2],f,r), parse_adr(s[3],e[3],t,r) ) );
+			break;
+		case 'l': case 'L': case 'g': case 'G': case 'e': case 'E':
+			field ( p, s[1], e[1] ); field ( p, s[2], e[2] );
+			field ( p, s[3], e[3] );
+			m_qlist.push_back ( quad_type( sop, parse_adr(s[1],e[1],f,r),
+				parse_adr(s[2],e[2],f,r), parse_short(s[3],e[3]) ) );
+			break;
+		// Block and vector quads (block.h): a block, or the value to
+		// fill with, the number of elements, and the destination block
+		case 'b': case 'v': case 'V': case 'u': case 'U': case 't': case 'T':
+			field ( p, s[1], e[1] ); field ( p, s[2], e[2] );
+			field ( p, s[3], e[3] );
+			m_qlist.push_back ( quad_type( sop, parse_adr(s[1],e[1],t,r),
+				parse_adr(s[2],e[2],f,f), parse_adr(s[3],e[3],t,r) ) );
+			break;
+		case 'w': case 'W':
+			field ( p, s[1], e[1] ); field ( p, s[2], e[2] );
+			field ( p, s[3], e[3] );
+			m_qlist.push_back ( quad_type( sop, parse_adr(s[1],e[1],f,r),
+				parse_adr(s[2],e[2],f,f), parse_adr(s[3],e[3],t,r) ) );
+			break;
+		// 2 address quads
+		case 'i': case 'I': case '=': case 'F': case 'f': case '~':
+		case 'n': case 'N':
+		{
+			bool sr = r; // is source operand real (float)?
+			if ( toupper(sop) == 'F' ) sr = !r;
+			field ( p, s[1], e[1] ); field ( p, s[2], e[2] );
+			m_qlist.push_back ( quad_type( sop,
+				parse_adr(s[1],e[1],f,sr), parse_adr(s[2],e[2],t,r) ) );
+		}
+			break;
+		// Control Transfer with address, Label
+		case 'c':
+			field ( p, s[1], e[1] ); field ( p, s[2], e[2] );
+			m_qlist.push_back ( quad_type( sop,
+				parse_adr(s[1],e[1],f,f), parse_short(s[2],e[2]) ) );
+			break;
+		// 1 address quads
+		case 'p': case 'P':
+			field ( p, s[1], e[1] );
+			m_qlist.push_back ( quad_type( sop, parse_adr(s[1],e[1],f,r) ) );
+			break;
+		// 2 Label  or integer literal quads
+		case '$':
+			field ( p, s[1], e[1] ); field ( p, s[2], e[2] );
+			m_qlist.push_back ( quad_type( sop,
+				parse_short(s[1],e[1]), parse_short(s[2],e[2]) ) );
+			break;
+		// 1 Label  or 1 integer literal quads
+		case 'j': case '#': case '^':
+			field ( p, s[1], e[1] );
+			m_qlist.push_back ( quad_type( sop, parse_short(s[1],e[1]) ) );
+			break;
+		// No operands
+		case '/': case 'h': case ';':
+			m_qlist.push_back ( quad_type(sop) );
+			break;
+		default:
+			{
+				string msg = "Invalid operation: ";
+				msg += sop;
+				posterror ( ERR_ERROR, msg );
+			}
+		} // end switch
+
+		// Record diagnostic flags
+		if ( m_errorlevel <= ERR_WARN )
+		{
+			m_qlist.flag ( m_qlist.size() - 1, traceon, traceoff,
+				dump );
+		}
+	} // for each line
+
+	return m_errorlevel;
+}
+
+// Find the next whitespace-separated field of the line, starting at p;
+// it is s up to e, empty at the end of the line.  p is left after it.
+inline void qfreader::field ( const char *&p, const char *&s, const char *&e ) const
+{
+	while ( p < m_eol && white ( *p ) ) ++p;
+	s = p;
+	while ( p < m_eol && !white ( *p ) ) ++p;
+	e = p;
+}
+
+// Form the text of an operand, s up to e, into a qop structure,
+// interpreting it as (1) an address or (2) a short (separate functions
+// for separate interpretations).  A character past the end reads as '\0'.
+
+// An "address" operand may actually be a different type, if specified
+// in immediate mode.  If dst is true, disallow immediate mode addressing
+// because the operand is a destination.  If flt is true, require the
+// operand to be a float if given in immediate mode.
+inline qop qfreader::parse_adr ( const char *s, const char *e, bool dst, bool flt )
+	const
+{
+	char code = ' '; // addressing mode
+	char utype = 'a'; // type of operand: 's', 'a', or 'f'
+	const char *p = s;
+
+	if ( p < e && (*p == '@' || *p == '#') )
+	{
+		code = *p++;
+		if ( code == '#' ) // find type of immediate operand
+		{
+			if ( p < e && *p == '-' ) utype = 's';
+			if ( memchr ( p, '.', e - p ) ) utype = 'f';
+		}
+	}
+	if ( p < e && *p == '/' )
+	{
+		if ( code == '@' ) code = 'N';
+		else if ( code == '#' ) code = 'M';
+		else code = '_';
+		++p;
+	}
+
+	// integrity checks
+	if ( code == '#' || code == 'M' )
+	{
+		if ( dst )
+		{
+			posterror ( ERR_ERROR, "Destination operand cannot be immediate" );
+			return qop ( word_type(0) );
+		}
+		if ( flt && utype != 'f' )
+		{
+			posterror ( ERR_ERROR, "Instruction requires float operand" );
+			return qop ( float(0.0) );
+		}
+		if ( !flt && utype == 'f' )
+		{
+			posterror ( ERR_ERROR, "Instruction requires int operand" );
+			return qop ( word_type(0) );
+		}
+	}
+
+	switch ( utype )
+	{
+	case 's':
+		return qop(get_int<word_type> ( p, e ), code, 's');
+	case 'f':
+		return qop(get_float ( p, e ), code, 'f');
+	default:
+		// Some addresses are negative offsets
+		return qop(adr_type(get_int<int> ( p, e )), code, 'a');
+	}
+}
+
+inline qop qfreader::parse_short ( const char *s, const char *e ) const
+{
+	const char c = s < e? *s: '\0';
+	if ( !isdigit(c) && c != '-' && c != '+' )
+	{
+		posterror ( ERR_ERROR, "Illegal Operand" );
+		return qop( label_type(0) );
+	}
+	return qop(get_int<label_type> ( s, e ));
+}
+
+// Note that the data section initialized memory below end
+inline void qfreader::initialized ( size_t end )
+{
+	if ( end > m_mem.Size() ) end = m_mem.Size();
+	if ( end > m_datasize ) m_datasize = end;
+}
+
+// Post a "loading-time" error
+// Note that errors of level FATAL must stop the loading
+inline void qfreader::posterror ( int level, const string &msg ) const
+{
+	string severity = "??? ";
+	switch ( level )
+	{
+	case ERR_WARN: severity = "Warning: "; break;
+	case ERR_ERROR: severity = "Error: "; break;
+	case ERR_FATAL: severity = "Fatal Error!: "; break;
+	}
+
+	m_err << "line " << m_lineno << ": ";
+	m_err.write ( m_line, m_eol - m_line ) << '\n';
+	m_err << severity << msg << endl;
+	if ( level > m_errorlevel )
+		m_errorlevel = level;
+}
+
+#endif // LOADER_H
@@ -0,0 +1,110 @@
+// mapfile.h
+// Read-only file contents for the Compiler Theory Class interpreter
+
+// A mapped_file holds the whole contents of a file, mapped into memory
+// where the system can do that, and read into a buffer where it can't.
+// It can also hold everything left on an input stream, such as cin.
+
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cerrno>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+class mapped_file
+{
+public:
+	mapped_file ( void ): m_data(""), m_size(0), m_mapped(false) {}
+	~mapped_file () { close(); }
+
+	bool open ( const char *fname ); // false, with errno set, on failure
+	void read ( istream &is );	// read to the end of the stream
+	void close ( void );
+
+	const char *data ( void ) const { return m_data; }
+	size_t size ( void ) const { return m_size; }
+
+private:
+	mapped_file ( const mapped_file & );		// not copyable
+	void operator = ( const mapped_file & );
+
+	const char *m_data;
+	size_t m_size;
+	bool m_mapped;		// m_data is mapped, not in m_buf
+	vector<char> m_buf;
+};
+
+inline bool mapped_file::open ( const char *fname )
+{
+	close();
+#ifdef HAVE_MMAP
+	const int fd = ::open ( fname, O_RDONLY );
+	if ( fd < 0 ) return false;
+	struct stat st;
+	if ( fstat ( fd, &st ) != 0 )
+	{
+		const int e = errno;
+		::close ( fd );
+		errno = e;
+		return false;
+	}
+	if ( st.st_size > 0 )
+	{
+		void *p = mmap ( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		if ( p != MAP_FAILED )
+		{
+			m_data = (const char *)p;
+			m_size = st.st_size;
+			m_mapped = true;
+			::close ( fd );
+			return true;
+		}
+	}
+	::close ( fd );
+	// Empty, or not a file that can be mapped: read it
+#endif
+	ifstream is ( fname, ios::in | ios::binary );
+	if ( !is ) return false;
+	read ( is );
+	return true;
+}
+
+inline void mapped_file::read ( istream &is )
+{
+	close();
+	char block[8192];
+	while ( is.read ( block, sizeof(block) ) || is.gcount() )
+		m_buf.insert ( m_buf.end(), block, block + is.gcount() );
+	if ( !m_buf.empty() )
+	{
+		m_data = &m_buf[0];
+		m_size = m_buf.size();
+	}
+}
+
+inline void mapped_file::close ( void )
+{
+#ifdef HAVE_MMAP
+	if ( m_mapped )
+		munmap ( (void *)m_data, m_size );
+#endif
+	m_data = "";
+	m_size = 0;
+	m_mapped = false;
+	m_buf.clear();
+}
+
+#endif // MAPFILE_H
@@ -0,0 +1,104 @@
+// opt.cpp
+// Quad file optimizer for the Virtual Quadruple Machine
+
+// vmq-opt reads a quad file, optimizes the program (see optimize.h), and
+// writes it as a quad file again: the data section as it was, then the
+// quads left.  It writes to the output file named, or to standard
+// output, and tells on standard error how many quads it removed.
+
+#define VERSION "2.04"	// as vmq.cpp
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
+#include <cerrno>
+
+#include "storage.h"
+#include "quad.h"
+#include "mapfile.h"
+#include "loader.h"
+#include "optimize.h"
+
+using namespace std;
+
+static void usage ( const char *prog )
+{
+	cerr << "Usage: " << prog << " <quadfile> [<outfile>]"
+		<< endl;
+	exit ( 10 );
+}
+
+int main ( int argc, char *argv[] )
+{
+	const char *qfname = 0, *oname = 0;
+	for ( int i = 1; i < argc; ++i )
+	{
+		if ( argv[i][0] == '-' || oname )
+			usage ( argv[0] );
+		else if ( !qfname )
+			qfname = argv[i];
+		else
+			oname = argv[i];
+	}
+	if ( !qfname ) usage ( argv[0] );
+
+	mapped_file qf;
+	if ( !qf.open ( qfname ) )
+	{
+		cerr << "Can't open file " << qfname << ": " << strerror(errno)
+			<< endl;
+		return 10;
+	}
+	storage_type mem ( MEM_DEFAULT );
+	quad_list qlist;
+	qfreader loader ( qf.data(), qf.size(), mem, qlist );
+	if ( loader.go() > ERR_WARN )
+	{
+		cerr << "Can't optimize " << qfname
+			<< ", for errors in the quad file" << endl;
+		return 10;
+	}
+
+	const size_t before = qlist.size();
+	const size_t removed = qoptimizer ( qlist ).go();
+
+	// The data section is the lines up to the first that doesn't start
+	// with a digit, as qfreader reads it
+	const char *text = qf.data(), *end = text + qf.size(), *p = text;
+	while ( p < end && isdigit ( *p ) )
+	{
+		const char *eol = (const char *)memchr ( p, '\n', end - p );
+		p = eol? eol + 1: end;
+	}
+
+	ofstream of;
+	if ( oname )
+	{
+		of.open ( oname );
+		if ( !of )
+		{
+			cerr << "Can't write file " << oname << ": " << strerror(errno)
+				<< endl;
+			return 10;
+		}
+	}
+	ostream &os = oname? of: cout;
+	os.write ( text, p - text );
+	if ( p > text && p[-1] != '\n' ) os << '\n';
+	for ( size_t i = 0; i < qlist.size(); ++i )
+		write_quad ( os, qlist[i] ) << '\n';
+	os.flush();
+	if ( !os )
+	{
+		cerr << "Can't write " << (oname? oname: "the output") << ": "
+			<< strerror(errno) << endl;
+		return 10;
+	}
+	cerr << qfname << ": " << before << " quads, " << removed
+		<< " removed" << endl;
+	return 0;
+}
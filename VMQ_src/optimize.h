@@ -0,0 +1,325 @@
+// optimize.h
+// Quad-level optimization for the Compiler Theory Class interpreter
+
+// A qoptimizer makes a loaded program smaller, without changing what it
+// does.  It
+//   - threads labels: a label of a j, l/g/e, L/G/E or c quad, or the
+//     entry of the '$' quad, that names a j quad names where that j
+//     goes instead, and so on down a chain of them;
+//   - removes ';' quads, which do nothing;
+//   - removes j, l/g/e and L/G/E quads that go where control would go
+//     anyway, the quad after them;
+//   - removes quads that can't be reached from quad 0, following the
+//     labels and the quads that fall through to the next, and taking a
+//     '/' to return to the quad after a c;
+// until no pass finds more, then numbers the quads left from 0 again and
+// renumbers every label to match.  A quad with a trace or dump flag (x,
+// X, @) is never removed or jumped past, if it can be reached, so traces
+// and dumps show what they did.  vmq --optimize does this as the program
+// is loaded; vmq-opt (opt.cpp) writes the program it leaves as a quad
+// file, which a trace or snapshot taken with --optimize is of.
+//
+// write_quad() writes a quad as a quad file gives it, for qfreader to
+// read back as the same quad.
+
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <charconv>
+#include "storage.h"
+#include "quad.h"
+
+using namespace std;
+
+class qoptimizer
+{
+public:
+	qoptimizer ( quad_list &qlist )
+		: m_qlist(qlist), m_n(qlist.size()) {}
+	// Optimize the program; the number of quads removed
+	size_t go ( void );
+
+private:
+	qoptimizer ( const qoptimizer & );	// not copied
+	void operator = ( const qoptimizer & );
+
+	// The operand of a quad that is a label, 1 to 3; 0 if none
+	static int slot ( const quad_type &q );
+	label_type label ( const quad_type &q ) const;
+	void relabel ( quad_type &q, label_type l );
+	bool flagged ( const quad_type &q ) const
+		{ return q.tron() || q.troff() || q.dump(); }
+	bool inside ( label_type l ) const
+		{ return l >= 0 && size_t ( l ) < m_n; }
+
+	size_t first ( size_t t );	// the first quad kept from t on
+	size_t target ( size_t t );	// where control reaching t goes
+	bool thread ( void );
+	bool fold ( void );
+	bool reach ( void );
+
+	quad_list &m_qlist;
+	const size_t m_n;	// quads, before any are removed
+	vector<bool> m_kept;
+	vector<size_t> m_skip;	// for a quad removed, one after it to try
+};
+
+inline int qoptimizer::slot ( const quad_type &q )
+{
+	switch ( q.op() )
+	{
+	case '$': case 'j':
+		return 1;
+	case 'c':
+		return q.op2().val.s >= 0? 2: 0;	// not the I/O functions
+	case 'l': case 'L': case 'g': case 'G': case 'e': case 'E':
+		return 3;
+	}
+	return 0;
+}
+
+inline label_type qoptimizer::label ( const quad_type &q ) const
+{
+	switch ( slot ( q ) )
+	{
+	case 1: return q.op1().val.s;
+	case 2: return q.op2().val.s;
+	case 3: return q.op3().val.s;
+	}
+	return -1;
+}
+
+inline void qoptimizer::relabel ( quad_type &q, label_type l )
+{
+	qop o1 = q.op1(), o2 = q.op2(), o3 = q.op3();
+	switch ( slot ( q ) )
+	{
+	case 1: o1.val.s = l; break;
+	case 2: o2.val.s = l; break;
+	case 3: o3.val.s = l; break;
+	}
+	q.Set ( q.op(), o1, o2, o3 );
+}
+
+inline size_t qoptimizer::first ( size_t t )
+{
+	size_t r = t;
+	while ( r < m_n && !m_kept[r] ) r = m_skip[r];
+	// Shorten the way there, for the next to look
+	while ( t < r )
+	{
+		const size_t s = m_skip[t];
+		m_skip[t] = r;
+		t = s;
+	}
+	return r;
+}
+
+// Through unflagged j quads, no further than a loop of them goes
+inline size_t qoptimizer::target ( size_t t )
+{
+	t = first ( t );
+	for ( size_t k = 0; k < m_n && t < m_n; ++k )
+	{
+		const quad_type &q = m_qlist[t];
+		if ( q.op() != 'j' || flagged ( q ) || !inside ( label ( q ) ) )
+			break;
+		t = first ( label ( q ) );
+	}
+	return t;
+}
+
+inline bool qoptimizer::thread ( void )
+{
+	bool changed = false;
+	for ( size_t i = 0; i < m_n; ++i )
+	{
+		const label_type l = label ( m_qlist[i] );
+		if ( !m_kept[i] || !inside ( l ) ) continue;
+		const size_t t = target ( l );
+		if ( t < m_n && t != size_t ( l ) )
+		{
+			quad_type q = m_qlist[i];
+			relabel ( q, label_type ( t ) );
+			m_qlist.set ( i, q );
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+// Remove the quads that do nothing, or nothing but go on to the next.
+// The last quad kept stays, so control never runs off the end of the
+// program where it didn't before.
+inline bool qoptimizer::fold ( void )
+{
+	bool changed = false;
+	for ( size_t i = 0; i < m_n; ++i )
+	{
+		const quad_type &q = m_qlist[i];
+		if ( !m_kept[i] || flagged ( q ) || first ( i + 1 ) == m_n )
+			continue;
+		bool skip = false;
+		switch ( q.op() )
+		{
+		case ';':
+			skip = true;
+			break;
+		case 'j':
+		case 'l': case 'L': case 'g': case 'G': case 'e': case 'E':
+			skip = inside ( label ( q ) )
+				&& target ( label ( q ) ) == target ( i + 1 );
+			break;
+		}
+		if ( skip )
+		{
+			m_kept[i] = false;
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+inline bool qoptimizer::reach ( void )
+{
+	vector<bool> reached ( m_n );
+	vector<size_t> work;
+	if ( m_n ) reached[0] = true, work.push_back ( 0 );
+	while ( !work.empty() )
+	{
+		const size_t i = work.back();
+		work.pop_back();
+		const quad_type &q = m_qlist[i];
+		size_t next[2];
+		int k = 0;
+		switch ( q.op() )
+		{
+		case '$': case 'j': case '/': case 'h':
+			break;
+		default:
+			next[k++] = first ( i + 1 );
+		}
+		if ( inside ( label ( q ) ) )
+			next[k++] = first ( label ( q ) );
+		while ( k-- )
+			if ( next[k] < m_n && !reached[next[k]] )
+			{
+				reached[next[k]] = true;
+				work.push_back ( next[k] );
+			}
+	}
+
+	bool changed = false;
+	for ( size_t i = 0; i < m_n; ++i )
+		if ( m_kept[i] && !reached[i] )
+		{
+			m_kept[i] = false;
+			changed = true;
+		}
+	return changed;
+}
+
+inline size_t qoptimizer::go ( void )
+{
+	m_kept.assign ( m_n, true );
+	m_skip.resize ( m_n );
+	for ( size_t i = 0; i < m_n; ++i ) m_skip[i] = i + 1;
+
+	// Each pass can make work for the others
+	bool changed = true;
+	while ( changed )
+	{
+		changed = thread();
+		changed = fold() || changed;
+		changed = reach() || changed;
+	}
+
+	// Number the quads kept, and their labels, from 0
+	vector<size_t> number ( m_n + 1 );
+	size_t kept = 0;
+	for ( size_t i = 0; i < m_n; ++i )
+		if ( m_kept[i] ) number[i] = kept++;
+	number[m_n] = kept;
+	quad_list qlist;
+	qlist.reserve ( kept );
+	for ( size_t i = 0; i < m_n; ++i )
+	{
+		if ( !m_kept[i] ) continue;
+		quad_type q = m_qlist[i];
+		const label_type l = label ( q );
+		if ( inside ( l ) )
+			relabel ( q, label_type ( number[first ( l )] ) );
+		qlist.push_back ( q );
+	}
+	m_qlist.swap ( qlist );
+	return m_n - kept;
+}
+
+// An operand as a quad file gives it.  Base-relative offsets are signed;
+// a float has a '.', as the reader tells floats by, and as many digits
+// as it takes to read back as the same float.
+inline ostream & write_qop ( ostream &os, const qop &q )
+{
+	switch ( q.adrmode )
+	{
+	case '#': os << '#'; break;
+	case '@': os << '@'; break;
+	case 'M': os << "#/"; break;
+	case '_': os << '/'; break;
+	case 'N': os << "@/"; break;
+	}
+	if ( q.vtype == 'f' )
+	{
+		char buf[64];
+		char *e = to_chars ( buf, buf + sizeof(buf), q.val.f ).ptr;
+		*e = '\0';
+		if ( !strchr ( buf, '.' ) )
+		{
+			char *x = strchr ( buf, 'e' );
+			if ( !x ) x = e;
+			memmove ( x + 2, x, e - x + 1 );
+			memcpy ( x, ".0", 2 );
+		}
+		return os << buf;
+	}
+	if ( q.vtype == 's' || q.adrmode == 'M' || q.adrmode == '_'
+		|| q.adrmode == 'N' )
+		return os << q.val.s;
+	return os << q.val.a;
+}
+
+// A quad as a line of a quad file gives it, without the '\n'
+inline ostream & write_quad ( ostream &os, const quad_type &q )
+{
+	if ( q.tron() ) os << 'x';
+	if ( q.troff() ) os << 'X';
+	if ( q.dump() ) os << '@';
+	os << q.op();
+	int n = 0;	// operands
+	switch ( q.op() )
+	{
+	case 'a': case 'A': case 's': case 'S': case 'm': case 'M':
+	case 'd': case 'D': case 'r': case '|': case '&':
+	case 'l': case 'L': case 'g': case 'G': case 'e': case 'E':
+	case 'b': case 'w': case 'W': case 'v': case 'V': case 'u': case 'U':
+	case 't': case 'T':
+		n = 3;
+		break;
+	case 'i': case 'I': case 'F': case '=': case 'f':
+	case '~': case 'n': case 'N': case 'c': case '$':
+		n = 2;
+		break;
+	case 'p': case 'P': case 'j': case '#': case '^':
+		n = 1;
+		break;
+	}
+	if ( n > 0 ) write_qop ( os << ' ', q.op1() );
+	if ( n > 1 ) write_qop ( os << ' ', q.op2() );
+	if ( n > 2 ) write_qop ( os << ' ', q.op3() );
+	return os;
+}
+
+#endif // OPTIMIZE_H
@@ -0,0 +1,124 @@
+// output.h
+// Output of the write pseudo-calls for the Compiler Theory Class interpreter
+
+// What a program writes collects in a buffer, formatted just as cout
+// would format it with its default flags: shorts in decimal, floats as
+// %g with 6 significant digits.  to_chars does the formatting, so no
+// locale or stream state is involved.  The buffer goes out (through
+// cout, so it stays in order with traces and dumps) when it is full,
+// before the program reads input, so prompts appear first, and when the
+// program stops.  Anything else that writes to standard output must
+// flush it first.
+//
+// Each thread has a buffer of its own.  A sink, if one is set, takes
+// the place of cout.  While a snapshot is taken (see snapshot.h), the
+// output is diverted into it instead.
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <charconv>
+#include <cstring>
+#include "storage.h"
+
+using namespace std;
+
+// Takes n bytes at p of output, for ctx
+typedef void (*out_sink) ( void *ctx, const char *p, size_t n );
+
+class out_buffer
+{
+public:
+	out_buffer (): m_len(0), m_sink(0), m_ctx(0), m_divert(0) {}
+	~out_buffer () { flush(); }
+
+	void put ( word_type x )
+	{
+		room ( 12 );
+		m_len = to_chars ( m_buf + m_len, m_buf + SIZE, x ).ptr - m_buf;
+	}
+	void put ( float x )
+	{
+		room ( 16 );
+		m_len = to_chars ( m_buf + m_len, m_buf + SIZE, x,
+			chars_format::general, 6 ).ptr - m_buf;
+	}
+	void put ( const char *s ) { write ( s, strlen ( s ) ); }
+	void write ( const char *p, size_t n );
+	void flush ( void )
+	{
+		if ( m_len ) out ( m_buf, m_len );
+		m_len = 0;
+	}
+
+	// Send what follows to f, or (if f is 0) cout
+	void sink ( out_sink f, void *ctx )
+	{
+		flush();
+		m_sink = f;
+		m_ctx = ctx;
+	}
+	// Keep what follows in s, not sending it on, until divert(0)
+	void divert ( string *s )
+	{
+		flush();
+		m_divert = s;
+	}
+
+private:
+	enum { SIZE = 8192 };
+	void room ( size_t n ) { if ( m_len + n > SIZE ) flush(); }
+	void out ( const char *p, size_t n )
+	{
+		if ( m_divert ) m_divert->append ( p, n );
+		else if ( m_sink ) m_sink ( m_ctx, p, n );
+		else cout.write ( p, n );
+	}
+
+	char m_buf[SIZE];
+	size_t m_len;
+	out_sink m_sink;
+	void *m_ctx;
+	string *m_divert;
+};
+
+inline void out_buffer::write ( const char *p, size_t n )
+{
+	room ( n );
+	if ( n > SIZE )
+		out ( p, n );
+	else
+	{
+		memcpy ( m_buf + m_len, p, n );
+		m_len += n;
+	}
+}
+
+// The output of the program this thread runs (vmq.cpp, libvmq.cpp)
+extern thread_local out_buffer qout;
+
+// A stream on this writes into qout, so that traces and dumps stay in
+// order with the program's output wherever that goes
+class qout_streambuf: public streambuf
+{
+protected:
+	int overflow ( int c )
+	{
+		if ( c != EOF )
+		{
+			const char ch = c;
+			qout.write ( &ch, 1 );
+		}
+		return 0;
+	}
+	streamsize xsputn ( const char *s, streamsize n )
+	{
+		qout.write ( s, n );
+		return n;
+	}
+};
+
+#endif // OUTPUT_H
@@ -0,0 +1,252 @@
+// profile.h
+// Execution profile for the Compiler Theory Class interpreter
+
+// A qprofile counts how many times each quad runs.  The switch engine
+// counts every quad; the threaded engine and native code count only the
+// first quad of each basic block (a leader), and every quad of a block
+// gets its leader's count.  That is exact, except that if the program
+// stops with an error, the quads after it in its block count once too
+// often.
+//
+// Quads belong to functions: a function runs from a '#' quad, or a quad
+// a call goes to, up to the next one.  The report, written when the
+// program stops, gives the hottest quads and functions, and how often
+// each loop went round: the count of each 'j' back to an earlier quad.
+// It is written as text, and as JSON to the same name plus ".json".
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "quad.h"
+
+using namespace std;
+
+class qprofile
+{
+public:
+	qprofile ( const quad_list &qlist, const char *fname );
+
+	// Counts to add to, indexed by quad; of blocks, by their leaders,
+	// when counting blocks
+	unsigned long long *counts ( void ) { return &m_counts[0]; }
+	bool leader ( size_t i ) const { return m_leader[i]; }
+	void count_blocks ( void ) { m_blocks = true; }
+
+	bool write ( void ) const;	// false if a report can't be written
+
+private:
+	enum { HOTTEST = 20 };	// quads in the text report
+	struct func_type
+	{
+		size_t entry;
+		unsigned long long count, calls;
+	};
+	// Orders indexes by their counts, highest first
+	struct hotter
+	{
+		const vector<unsigned long long> &m_c;
+		hotter ( const vector<unsigned long long> &c ): m_c(c) {}
+		bool operator () ( size_t a, size_t b ) const { return m_c[a] > m_c[b]; }
+	};
+	label_type target ( size_t i ) const;
+	void tally ( vector<unsigned long long> &quads,
+		vector<func_type> &funcs, vector<size_t> &order ) const;
+	static string text ( const quad_type &q );
+	static string json_string ( const string &s );
+
+	const quad_list &m_qlist;
+	string m_fname;
+	vector<unsigned long long> m_counts;
+	vector<bool> m_leader, m_entry;
+	bool m_blocks;
+};
+
+inline qprofile::qprofile ( const quad_list &qlist,
+	const char *fname )
+	: m_qlist(qlist), m_fname(fname), m_counts(qlist.size() + 1, 0),
+	  m_leader(qlist.size() + 1, false), m_entry(qlist.size(), false),
+	  m_blocks(false)
+{
+	// Leaders: quad 0, targets of transfers, and the quads after them
+	const size_t n = qlist.size();
+	if ( n ) m_leader[0] = true;
+	for ( size_t i = 0; i < n; ++i )
+	{
+		const char op = qlist[i].op();
+		const label_type t = target ( i );
+		if ( t >= 0 ) m_leader[t] = true;
+		switch ( op )
+		{
+		case 'l': case 'L': case 'g': case 'G': case 'e': case 'E':
+		case 'j': case 'c': case '/': case 'h': case '$':
+			m_leader[i+1] = true;
+		}
+		if ( op == '#' ) m_entry[i] = true;
+		if ( op == 'c' && t >= 0 ) m_entry[t] = true;
+	}
+	m_leader[n] = false; // the end of the program is no quad
+}
+
+// The quad that quad i may transfer to, or -1
+inline label_type qprofile::target ( size_t i ) const
+{
+	const quad_type &q = m_qlist[i];
+	label_type t = -1;
+	switch ( q.op() )
+	{
+	case 'l': case 'L': case 'g': case 'G': case 'e': case 'E':
+		t = q.op3().val.s;
+		break;
+	case 'c':
+		t = q.op2().val.s;
+		break;
+	case 'j': case '$':
+		t = q.op1().val.s;
+		break;
+	}
+	return t >= 0 && size_t ( t ) < m_qlist.size()? t: -1;
+}
+
+// Counts of quads, and of functions, and the quads that ran, hottest first
+inline void qprofile::tally ( vector<unsigned long long> &quads,
+	vector<func_type> &funcs, vector<size_t> &order ) const
+{
+	const size_t n = m_qlist.size();
+	quads.assign ( m_counts.begin(), m_counts.begin() + n );
+	unsigned long long block = 0;
+	for ( size_t i = 0; m_blocks && i < n; ++i )
+	{
+		if ( m_leader[i] ) block = m_counts[i];
+		quads[i] = block;
+	}
+
+	funcs.clear();
+	for ( size_t i = 0; i < n; ++i )
+	{
+		if ( m_entry[i] || funcs.empty() )
+		{
+			func_type f = { i, 0, quads[i] };
+			funcs.push_back ( f );
+		}
+		funcs.back().count += quads[i];
+	}
+
+	order.clear();
+	for ( size_t i = 0; i < n; ++i )
+		if ( quads[i] ) order.push_back ( i );
+	stable_sort ( order.begin(), order.end(), hotter ( quads ) );
+}
+
+inline bool qprofile::write ( void ) const
+{
+	vector<unsigned long long> quads;
+	vector<func_type> funcs;
+	vector<size_t> order;
+	tally ( quads, funcs, order );
+
+	unsigned long long total = 0;
+	for ( size_t i = 0; i < quads.size(); ++i ) total += quads[i];
+	const double pct = total? 100.0 / total: 0;
+
+	// Functions, hottest first, and their index by quad
+	vector<size_t> func_of ( m_qlist.size() );
+	for ( size_t f = 0; f < funcs.size(); ++f )
+		for ( size_t i = funcs[f].entry; i < m_qlist.size()
+			&& (f + 1 == funcs.size() || i < funcs[f+1].entry); ++i )
+			func_of[i] = funcs[f].entry;
+	vector<unsigned long long> fcount;
+	for ( size_t f = 0; f < funcs.size(); ++f )
+		fcount.push_back ( funcs[f].count );
+	vector<size_t> forder;
+	for ( size_t f = 0; f < funcs.size(); ++f )
+		if ( funcs[f].count ) forder.push_back ( f );
+	stable_sort ( forder.begin(), forder.end(), hotter ( fcount ) );
+
+	// Back-edges, most taken first
+	vector<size_t> back;
+	for ( size_t i = 0; i < m_qlist.size(); ++i )
+		if ( m_qlist[i].op() == 'j' && target ( i ) >= 0
+			&& size_t ( target ( i ) ) <= i && quads[i] )
+			back.push_back ( i );
+	stable_sort ( back.begin(), back.end(), hotter ( quads ) );
+
+	ofstream os ( m_fname.c_str() );
+	os << "Quads executed: " << total << "\n\n";
+	os << "Hottest quads\n"
+		<< "       count      %   quad  function  quad\n";
+	for ( size_t k = 0; k < order.size() && k < HOTTEST; ++k )
+	{
+		const size_t i = order[k];
+		os << setw(12) << quads[i] << ' ' << fixed << setprecision(2)
+			<< setw(6) << quads[i] * pct << ' ' << setw(6) << i << "  "
+			<< setw(8) << func_of[i] << "  " << text ( m_qlist[i] ) << '\n';
+	}
+	os << "\nHottest functions\n"
+		<< "       count      %   entry       calls\n";
+	for ( size_t k = 0; k < forder.size(); ++k )
+	{
+		const func_type &f = funcs[forder[k]];
+		os << setw(12) << f.count << ' ' << setw(6) << f.count * pct << ' '
+			<< setw(7) << f.entry << ' ' << setw(11) << f.calls << '\n';
+	}
+	os << "\nLoop back-edges (j to an earlier quad)\n"
+		<< "       taken   from     to\n";
+	for ( size_t k = 0; k < back.size(); ++k )
+		os << setw(12) << quads[back[k]] << ' ' << setw(6) << back[k] << ' '
+			<< setw(6) << target ( back[k] ) << '\n';
+	os.close();
+	if ( !os ) return false;
+
+	ofstream js ( (m_fname + ".json").c_str() );
+	js << "{\n  \"total\": " << total << ",\n  \"quads\": [";
+	for ( size_t k = 0; k < order.size(); ++k )
+	{
+		const size_t i = order[k];
+		js << (k? ",": "") << "\n    { \"quad\": " << i << ", \"count\": "
+			<< quads[i] << ", \"function\": " << func_of[i]
+			<< ", \"text\": " << json_string ( text ( m_qlist[i] ) ) << " }";
+	}
+	js << "\n  ],\n  \"functions\": [";
+	for ( size_t k = 0; k < forder.size(); ++k )
+	{
+		const func_type &f = funcs[forder[k]];
+		js << (k? ",": "") << "\n    { \"entry\": " << f.entry
+			<< ", \"count\": " << f.count << ", \"calls\": " << f.calls
+			<< " }";
+	}
+	js << "\n  ],\n  \"back_edges\": [";
+	for ( size_t k = 0; k < back.size(); ++k )
+		js << (k? ",": "") << "\n    { \"from\": " << back[k] << ", \"to\": "
+			<< target ( back[k] ) << ", \"taken\": " << quads[back[k]]
+			<< " }";
+	js << "\n  ]\n}\n";
+	js.close();
+	return bool ( js );
+}
+
+inline string qprofile::text ( const quad_type &q )
+{
+	ostringstream os;
+	os << q;
+	return os.str();
+}
+
+inline string qprofile::json_string ( const string &s )
+{
+	string r = "\"";
+	for ( size_t i = 0; i < s.size(); ++i )
+	{
+		if ( s[i] == '"' || s[i] == '\\' ) r += '\\';
+		r += s[i];
+	}
+	return r + '"';
+}
+
+#endif // PROFILE_H
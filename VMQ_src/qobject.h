@@ -0,0 +1,226 @@
+// qobject.h
+// Binary quad object files for the Compiler Theory Class interpreter
+
+// A quad object file holds a program as loaded from a .q file: a header,
+// an image of the initialized part of data memory, and a fixed-width
+// record for each quad.  It is mapped into memory (see mapfile.h) and
+// copied out with no parsing.  Numbers are in the byte order of the
+// machine that wrote the file; a file written with another byte order is
+// not recognized.
+//
+// "vmq --emit-binary prog.q" writes prog.qb.  When vmq is asked to run
+// prog.q and prog.qb was written from the same text of prog.q, vmq
+// loads prog.qb instead.  vmq also runs a quad object file named directly.
+
+#ifndef QOBJECT_H
+#define QOBJECT_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <climits>
+
+#include "storage.h"
+#include "quad.h"
+
+using namespace std;
+
+#define QOBJ_MAGIC "VMQB"
+#define QOBJ_ORDER 0x0102	// reads as 0x0201 with the other byte order
+#ifndef VMQ_WIDE
+#define QOBJ_VERSION 2		// change when the layout changes
+#else
+#define QOBJ_VERSION 0x8003	// ... and for the wide machine (storage.h)
+#endif
+
+struct qobj_header
+{
+	char magic[4];		// QOBJ_MAGIC
+	unsigned short order;	// QOBJ_ORDER
+	unsigned short version;	// QOBJ_VERSION
+	unsigned int memsize;	// size of data memory
+	unsigned int datasize;	// bytes of data image that follow the header
+	unsigned int nquads;	// quad records that follow the data image
+	unsigned int srcsize;	// size of the .q file it was made from
+	unsigned long long srchash;	// qobj_srchash of that .q file
+};
+
+// All members are chars, so records need no alignment
+struct qobj_operand
+{
+	char val[sizeof(opval)];
+	char vtype;
+	char adrmode;
+};
+
+struct qobj_record
+{
+	char op;
+	char flags;	// QOBJ_TRON | QOBJ_TROFF | QOBJ_DUMP
+	qobj_operand o1, o2, o3;
+};
+
+#define QOBJ_TRON 1
+#define QOBJ_TROFF 2
+#define QOBJ_DUMP 4
+
+// Name of the object file cached for a .q file
+inline string qobj_cachename ( const char *qfname )
+{
+	return string ( qfname ) + 'b';
+}
+
+// A hash of the text of a .q file (FNV-1a).  Unlike its size and
+// modification time, it changes whenever the text does.
+inline unsigned long long qobj_srchash ( const char *p, size_t n )
+{
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	for ( size_t i = 0; i < n; ++i )
+		h = (h ^ (unsigned char)p[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+// Load the contents of a quad object file.  go() returns false, and
+// leaves memory and the quad list alone, unless the whole file is good
+// and, if src is given, was made from a .q file with that text.
+class qbreader
+{
+public:
+	qbreader ( storage_type &mem, quad_list &qlist )
+		: m_mem(mem), m_qlist(qlist), m_datasize(0) {}
+	bool go ( const char *p, size_t size, const char *src = 0,
+		size_t srcsize = 0 );
+	// Size of the data image the file held
+	size_t datasize ( void ) const { return m_datasize; }
+
+private:
+	static qop operand ( const qobj_operand &r );
+
+	storage_type &m_mem;
+	quad_list &m_qlist;
+	size_t m_datasize;
+};
+
+inline bool qbreader::go ( const char *p, size_t size,
+	const char *src, size_t srcsize )
+{
+	qobj_header h;
+	if ( size < sizeof(h) ) return false;
+	memcpy ( &h, p, sizeof(h) );
+	if ( memcmp ( h.magic, QOBJ_MAGIC, sizeof(h.magic) ) != 0
+		|| h.order != QOBJ_ORDER || h.version != QOBJ_VERSION
+		|| h.memsize != m_mem.Size() || h.datasize > m_mem.Size()
+		|| h.nquads > QUAD_MAX
+		|| size != sizeof(h) + h.datasize + h.nquads * sizeof(qobj_record) )
+		return false;
+	if ( src && ( h.srcsize != srcsize
+			|| h.srchash != qobj_srchash ( src, srcsize ) ) )
+		return false;
+
+	// Operands a quad list can't hold, which only a damaged file has
+	const qobj_record *r =
+		(const qobj_record *)(p + sizeof(h) + h.datasize);
+	for ( unsigned int i = 0; i < h.nquads; ++i )
+		if ( !quad_list::packs ( operand ( r[i].o1 ) )
+			|| !quad_list::packs ( operand ( r[i].o2 ) )
+			|| !quad_list::packs ( operand ( r[i].o3 ) ) )
+			return false;
+
+	// Initialized data
+	p += sizeof(h);
+	m_mem.Set ( 0, p, h.datasize );
+	m_datasize = h.datasize;
+	p += h.datasize;
+
+	// Quads
+	m_qlist.reserve ( m_qlist.size() + h.nquads );
+	for ( unsigned int i = 0; i < h.nquads; ++i, ++r )
+	{
+		m_qlist.push_back ( quad_type ( r->op, operand ( r->o1 ),
+			operand ( r->o2 ), operand ( r->o3 ) ) );
+		m_qlist.flag ( m_qlist.size() - 1, r->flags & QOBJ_TRON,
+			r->flags & QOBJ_TROFF, r->flags & QOBJ_DUMP );
+	}
+	return true;
+}
+
+inline qop qbreader::operand ( const qobj_operand &r )
+{
+	qop q;
+	memcpy ( &q.val, r.val, sizeof(q.val) );
+	q.vtype = r.vtype;
+	q.adrmode = r.adrmode;
+	return q;
+}
+
+// Write a quad object file for a program loaded from a .q file.  datasize
+// is the size of the initialized part of data memory; src is the text of
+// the .q file.
+class qbwriter
+{
+public:
+	qbwriter ( const string &fname, const storage_type &mem,
+		const quad_list &qlist, size_t datasize,
+		const char *src, size_t srcsize )
+		: m_fname(fname), m_mem(mem), m_qlist(qlist),
+		  m_datasize(datasize), m_src(src), m_srcsize(srcsize) {}
+	bool go ( void ); // false, with errno set, if the file can't be written
+
+private:
+	static qobj_operand operand ( const qop &q );
+
+	string m_fname;
+	const storage_type &m_mem;
+	const quad_list &m_qlist;
+	size_t m_datasize;
+	const char *m_src;
+	size_t m_srcsize;
+};
+
+inline bool qbwriter::go ( void )
+{
+	qobj_header h;
+	memset ( &h, 0, sizeof(h) );
+	memcpy ( h.magic, QOBJ_MAGIC, sizeof(h.magic) );
+	h.order = QOBJ_ORDER;
+	h.version = QOBJ_VERSION;
+	h.memsize = m_mem.Size();
+	h.datasize = m_datasize;
+	h.nquads = m_qlist.size();
+	h.srcsize = m_srcsize;
+	h.srchash = qobj_srchash ( m_src, m_srcsize );
+
+	vector<qobj_record> recs ( m_qlist.size() );
+	for ( size_t i = 0; i < m_qlist.size(); ++i )
+	{
+		const quad_type &q = m_qlist[i];
+		recs[i].op = q.op();
+		recs[i].flags = (q.tron()? QOBJ_TRON: 0) | (q.troff()? QOBJ_TROFF: 0)
+			| (q.dump()? QOBJ_DUMP: 0);
+		recs[i].o1 = operand ( q.op1() );
+		recs[i].o2 = operand ( q.op2() );
+		recs[i].o3 = operand ( q.op3() );
+	}
+
+	ofstream os ( m_fname.c_str(), ios::out | ios::binary | ios::trunc );
+	if ( !os ) return false;
+	os.write ( (const char *)&h, sizeof(h) );
+	os.write ( m_mem.Image(), m_datasize );
+	if ( !recs.empty() )
+		os.write ( (const char *)&recs[0], recs.size() * sizeof(recs[0]) );
+	os.close();
+	return bool ( os );
+}
+
+inline qobj_operand qbwriter::operand ( const qop &q )
+{
+	qobj_operand r;
+	memcpy ( r.val, &q.val, sizeof(r.val) );
+	r.vtype = q.vtype;
+	r.adrmode = q.adrmode;
+	return r;
+}
+
+#endif // QOBJECT_H
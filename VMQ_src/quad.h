@@ -9,19 +9,28 @@
 #include <iostream>
 #include <iomanip>
 #include <stdexcept>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstring>
 #include "storage.h"
 
 using namespace std;
 
+// Error severity levels, of loading and running quads
+#define ERR_WARN 5
+#define ERR_ERROR 10
+#define ERR_FATAL 20
+
 // A quadruple operand value can be of one of several types
 union opval
 {
-	short s;	// int or quadruple number (label)
+	label_type s;	// int or quadruple number (label)
 	adr_type a;	// data memory address
 	float f;	// float
 
 	opval ( void ): a() {}	// There is no unambiguous null value; use 0
-	opval ( short sv ): s(sv) {}
+	opval ( label_type sv ): s(sv) {}
 	opval ( adr_type av ): a(av) {}
 	opval ( float fv ): f(fv) {}
 };
@@ -35,13 +44,13 @@ struct qop
 					// base-rel: 'M' immediate; '_' normal; 'N' indirect
 
 	qop ( void ): val(), vtype('a'), adrmode(' ') {}
-	qop ( short v, char a = ' ', char vt = 's' )
+	qop ( label_type v, char a = ' ', char vt = 's' )
 		: val(v), vtype(vt), adrmode(a) {}
 	qop ( adr_type v, char a = ' ', char vt = 'a' )
 		: val(v), vtype(vt), adrmode(a) {}
 	qop ( float v, char a = ' ', char vt = 'f' )
 		: val(v), vtype(vt), adrmode(a) {}
-	void set ( short v, char a = ' ', char vt = 's' )
+	void set ( label_type v, char a = ' ', char vt = 's' )
 		{ val = v; vtype = vt; adrmode = a; }
 	void set ( adr_type v = 0, char a = ' ', char vt = 'a' )
 		{ val = v; vtype = vt; adrmode = a; }
@@ -49,7 +58,7 @@ struct qop
 		{ val = v; vtype = vt; adrmode = a; }
 
 	// Functions to compute l- and r-values
-	inline adr_type lval ( const storage_type &mem ) throw ( runtime_error )
+	inline adr_type lval ( const storage_type &mem )
 	{
 		switch ( adrmode )
 		{
@@ -58,38 +67,40 @@ struct qop
 		case 'N': return mem.Adr ( adr_type(mem.DLink() + val.s) );
 		case ' ': return val.a;
 		case '@': return mem.Adr ( val.a );
+		default: throw runtime_error ( "Illegal addressing mode" );
 		}
 	}
 	// r-values come in several types
 
 	// For integer or label operands
-	inline short ival ( const storage_type &mem ) throw ( runtime_error )
+	inline label_type ival ( const storage_type & )
 	{
 		switch ( adrmode )
 		{
-		case '#': case 'M': case '_': case 'N': case '@':
-			throw runtime_error ("Illegal addressing mode for this operand" );
 		case ' ': return val.s;
+		default:
+			throw runtime_error ("Illegal addressing mode for this operand" );
 		}
 	}
 
 	// for addresses referring to shorts
-	short sval ( const storage_type &mem )
+	word_type sval ( const storage_type &mem )
 	{
 		switch ( adrmode )
 		{
-		case 'M': return short ( mem.DLink() + val.s );
-		case '#': return short ( val.s );
+		case 'M': return word_type ( mem.DLink() + val.s );
+		case '#': return word_type ( val.s );
 		case '_': return mem.Short ( adr_type(mem.DLink() + val.s) );
 		case ' ': return mem.Short ( val.a );
 		case 'N': return
 			mem.Short ( mem.Adr ( adr_type(mem.DLink() + val.s) ) );
 		case '@': return mem.Short ( mem.Adr ( val.a ) );
+		default: throw runtime_error ( "Illegal addressing mode" );
 		}
 	}
 
 	// for addresses referring to chars
-	short cval ( const storage_type &mem )
+	word_type cval ( const storage_type &mem )
 	{
 		switch ( adrmode )
 		{
@@ -100,6 +111,7 @@ struct qop
 		case 'N': return
 			mem.Char ( mem.Adr ( adr_type(mem.DLink() + val.s) ) );
 		case '@': return mem.Char ( mem.Adr ( val.a ) );
+		default: throw runtime_error ( "Illegal addressing mode" );
 		}
 	}
 
@@ -114,6 +126,7 @@ struct qop
 		case 'N': return
 			mem.Float ( mem.Adr ( adr_type(mem.DLink() + val.s) ) );
 		case '@': return mem.Float ( mem.Adr ( val.a ) );
+		default: throw runtime_error ( "Illegal addressing mode" );
 		}
 	}
 
@@ -129,6 +142,7 @@ struct qop
 		case 'N': return
 			mem.Adr ( mem.Adr ( adr_type(mem.DLink() + val.s) ) );
 		case '@': return mem.Adr ( mem.Adr ( val.a ) );
+		default: throw runtime_error ( "Illegal addressing mode" );
 		}
 	}
 
@@ -164,6 +178,192 @@ private:
 	qop m_o1, m_o2, m_o3;
 };
 
+// Diagnostic flags of a quad, as quad_list keeps them
+#define QF_TRON 1	// 'x'
+#define QF_TROFF 2	// 'X'
+#define QF_DUMP 4	// '@'
+
+// A quad_list packs the addressing mode and value type of an operand into
+// a byte: the index of the mode in QL_MODES, plus 8 times the index of the
+// type in QL_TYPES.  QL_UNPACK gives them back, type then mode, from
+// twice the byte, for a loop to copy as a pair.
+#define QL_MODES " #@M_N"
+#define QL_TYPES "saf"
+#define QL_UNPACK "s s#s@sMs_sN????a a#a@aMa_aN????f f#f@fMf_fN"
+
+// A loaded program: its quads, kept as parallel arrays of their parts
+// rather than as quad_type objects.  An opcode, a mode byte for each
+// operand and three values take 16 bytes a quad, where a quad_type takes
+// 28, so the switch engine and the decoders find more quads in each cache
+// line they read.  The trace and dump flags, which few quads have, are
+// kept in a table aside, in order of quad.
+//
+// A quad_list holds quads as a vector of quad_type would, but gives one
+// by value; set() changes it.
+class quad_list
+{
+public:
+	size_t size ( void ) const { return m_ops.size(); }
+	bool empty ( void ) const { return m_ops.empty(); }
+	void clear ( void );
+	void reserve ( size_t n );
+	void push_back ( const quad_type &q );
+	void set ( size_t i, const quad_type &q );
+	void flag ( size_t i, bool tron, bool troff, bool dump );
+	void swap ( quad_list &other );
+
+	// Quad i, whole
+	quad_type operator [] ( size_t i ) const;
+	quad_type back ( void ) const { return (*this)[size() - 1]; }
+
+	// ... and in parts
+	char op ( size_t i ) const { return m_ops[i]; }
+	qop op1 ( size_t i ) const { return reader ( *this ).op1 ( i ); }
+	qop op2 ( size_t i ) const { return reader ( *this ).op2 ( i ); }
+	qop op3 ( size_t i ) const { return reader ( *this ).op3 ( i ); }
+	unsigned char flags ( size_t i ) const;	// QF_ flags
+	bool flagged ( void ) const { return !m_flags.empty(); } // any quad
+
+	// Has operand q a mode and type a quad_list can hold?  Those the
+	// loader makes have; a damaged quad object file may hold others.
+	static bool packs ( const qop &q )
+		{
+			return q.adrmode && strchr ( QL_MODES, q.adrmode )
+				&& q.vtype && strchr ( QL_TYPES, q.vtype );
+		}
+
+	// The parts of the quads, read straight from the arrays.  A loop
+	// holds one, so it needn't look up the arrays again after each store
+	// to data memory, which could (as the compiler sees it) move them.
+	// Good until the quad_list changes.
+	class reader
+	{
+	public:
+		reader ( const quad_list &ql )
+			: m_ops(ql.m_ops.data()), m_modes(ql.m_modes.data()),
+				m_vals(ql.m_vals.data()) {}
+		char op ( size_t i ) const { return m_ops[i]; }
+		qop op1 ( size_t i ) const { return operand ( 3*i ); }
+		qop op2 ( size_t i ) const { return operand ( 3*i + 1 ); }
+		qop op3 ( size_t i ) const { return operand ( 3*i + 2 ); }
+		// Into o, a field at a time, which compiles to less than
+		// building a qop and copying it
+		void op1 ( size_t i, qop &o ) const { operand ( 3*i, o ); }
+		void op2 ( size_t i, qop &o ) const { operand ( 3*i + 1, o ); }
+		void op3 ( size_t i, qop &o ) const { operand ( 3*i + 2, o ); }
+	private:
+		qop operand ( size_t k ) const
+			{
+				qop q;
+				operand ( k, q );
+				return q;
+			}
+		void operand ( size_t k, qop &q ) const
+			{
+				const char *m = QL_UNPACK + 2 * m_modes[k];
+				q.val = m_vals[k];
+				q.vtype = m[0];
+				q.adrmode = m[1];
+			}
+		const char *m_ops;
+		const unsigned char *m_modes;
+		const opval *m_vals;
+	};
+
+private:
+	static unsigned char pack ( const qop &q );
+
+	vector<char> m_ops;
+	vector<unsigned char> m_modes;	// three a quad
+	vector<opval> m_vals;	// three a quad
+	typedef pair<size_t, unsigned char> flag_type;	// quad, QF_ flags
+	vector<flag_type> m_flags;
+};
+
+inline unsigned char quad_list::pack ( const qop &q )
+{
+	if ( !packs ( q ) )
+		throw runtime_error ( "Operand mode or type out of range" );
+	return (unsigned char)( (strchr ( QL_MODES, q.adrmode ) - QL_MODES)
+		+ 8 * (strchr ( QL_TYPES, q.vtype ) - QL_TYPES) );
+}
+
+inline void quad_list::clear ( void )
+{
+	m_ops.clear();
+	m_modes.clear();
+	m_vals.clear();
+	m_flags.clear();
+}
+
+inline void quad_list::reserve ( size_t n )
+{
+	m_ops.reserve ( n );
+	m_modes.reserve ( 3 * n );
+	m_vals.reserve ( 3 * n );
+}
+
+inline void quad_list::push_back ( const quad_type &q )
+{
+	m_ops.push_back ( 0 );
+	m_modes.resize ( m_modes.size() + 3 );
+	m_vals.resize ( m_vals.size() + 3 );
+	set ( size() - 1, q );
+}
+
+inline void quad_list::set ( size_t i, const quad_type &q )
+{
+	const qop *o[3] = { &q.op1(), &q.op2(), &q.op3() };
+	for ( int k = 0; k < 3; ++k )
+	{
+		m_modes[3*i + k] = pack ( *o[k] );
+		m_vals[3*i + k] = o[k]->val;
+	}
+	m_ops[i] = q.op();
+	flag ( i, q.tron(), q.troff(), q.dump() );
+}
+
+inline void quad_list::flag ( size_t i, bool tron, bool troff, bool dump )
+{
+	const unsigned char f = (tron? QF_TRON: 0) | (troff? QF_TROFF: 0)
+		| (dump? QF_DUMP: 0);
+	vector<flag_type>::iterator p = lower_bound ( m_flags.begin(),
+		m_flags.end(), flag_type ( i, 0 ) );
+	const bool found = p != m_flags.end() && p->first == i;
+	if ( f && found )
+		p->second = f;
+	else if ( f )
+		m_flags.insert ( p, flag_type ( i, f ) );
+	else if ( found )
+		m_flags.erase ( p );
+}
+
+inline unsigned char quad_list::flags ( size_t i ) const
+{
+	if ( m_flags.empty() ) return 0;
+	vector<flag_type>::const_iterator p = lower_bound ( m_flags.begin(),
+		m_flags.end(), flag_type ( i, 0 ) );
+	return p != m_flags.end() && p->first == i? p->second: 0;
+}
+
+inline void quad_list::swap ( quad_list &other )
+{
+	m_ops.swap ( other.m_ops );
+	m_modes.swap ( other.m_modes );
+	m_vals.swap ( other.m_vals );
+	m_flags.swap ( other.m_flags );
+}
+
+inline quad_type quad_list::operator [] ( size_t i ) const
+{
+	quad_type q ( m_ops[i], op1 ( i ), op2 ( i ), op3 ( i ) );
+	const unsigned char f = flags ( i );
+	if ( f & QF_TRON ) q.TraceOn();
+	if ( f & QF_TROFF ) q.TraceOff();
+	if ( f & QF_DUMP ) q.DumpOn();
+	return q;
+}
+
 ostream & operator << ( ostream &os, const qop &q )
 {
 	const ios::fmtflags fmt = os.flags();
@@ -209,6 +409,13 @@ ostream & operator << ( ostream &os, const quad_type &q )
 				<< ", " << q.m_o2
 				<< ", " << q.m_o3;
 			break;
+		// Block and vector quads
+		case 'b': case 'w': case 'W': case 'v': case 'V': case 'u': case 'U':
+		case 't': case 'T':
+			os	<< ", " << q.m_o1
+				<< ", " << q.m_o2
+				<< ", " << q.m_o3;
+			break;
 		case 'l': case 'L': case 'g': case 'G': case 'e': case 'E':
 			os	<< ", " << q.m_o1
 				<< ", " << q.m_o2
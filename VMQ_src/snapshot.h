@@ -0,0 +1,194 @@
+// snapshot.h
+// Machine snapshots for the Compiler Theory Class interpreter
+
+// A qsnapshot holds the state of the machine just before a program first
+// reads input: the contents of data memory and its stack registers, the
+// quad about to run, the size of the global data area, and what the
+// program wrote before then.  Everything up to that point depends only
+// on the program, so a program that fills its tables before it reads
+// anything can start each run from the snapshot and skip that work (see
+// interpreter::snapshot and go).  Running from a snapshot gives just
+// what running from the start would.
+//
+// A snapshot file holds a header, the image of data memory (the whole
+// store, guard region and all; see storage.h) and the output.  It is
+// mapped into memory (see mapfile.h), and the image is copied from the
+// mapping into data memory at the start of each run.  A
+// file is for the program it was taken of, as loaded: one taken of any
+// other program, or with another byte order or layout, is not recognized.
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include "storage.h"
+#include "quad.h"
+#include "mapfile.h"
+
+using namespace std;
+
+#define QSNAP_MAGIC "VMQS"
+#define QSNAP_ORDER 0x0102	// reads as 0x0201 with the other byte order
+#define QSNAP_VERSION 3		// change when the layout changes
+
+struct qsnap_header
+{
+	char magic[4];		// QSNAP_MAGIC
+	unsigned short order;	// QSNAP_ORDER
+	unsigned short version;	// QSNAP_VERSION
+	unsigned long long key;	// of the program (qsnapshot::key)
+	unsigned int memsize;	// extent of data memory, whose image follows
+	unsigned int outsize;	// bytes of output that follow the image
+	unsigned int pc;	// quad about to run
+	unsigned int gsize;	// size of global data area
+	unsigned int top;	// stack top
+	unsigned int link;	// dynamic link
+};
+
+class qsnapshot
+{
+public:
+	qsnapshot ( void ): m_image(0), m_size(0), m_taken(false), m_pc(0),
+		m_gsize(0), m_top(0), m_link(0) {}
+
+	// Identifies a program, as loaded into mem, for snapshot files
+	static unsigned long long key ( const quad_list &qlist,
+		const storage_type &mem );
+
+	bool taken ( void ) const { return m_taken; }
+	size_t pc ( void ) const { return m_pc; }
+	adr_type gsize ( void ) const { return m_gsize; }
+	string &output ( void ) { return m_output; }
+	const string &output ( void ) const { return m_output; }
+
+	// Keep the state of mem, about to run quad pc
+	void take ( const storage_type &mem, size_t pc, adr_type gsize );
+	void restore ( storage_type &mem ) const
+		{ mem.Copy ( m_image, m_top, m_link ); }
+
+	// false, with errno set, if the file can't be written
+	bool save ( const char *fname, unsigned long long key ) const;
+	// false, and nothing taken, unless the file holds a good snapshot of
+	// the program with that key and memory of that extent
+	bool load ( const char *fname, unsigned long long key, size_t memsize );
+
+private:
+	static void hash ( unsigned long long &h, const void *p, size_t n );
+
+	vector<char> m_own;	// the image, when taken here
+	mapped_file m_map;	// ... or loaded from a file
+	const char *m_image;
+	size_t m_size;
+	bool m_taken;
+	size_t m_pc;
+	adr_type m_gsize, m_top, m_link;
+	string m_output;
+
+	qsnapshot ( const qsnapshot & );	// not copied
+	void operator = ( const qsnapshot & );
+};
+
+// FNV-1a
+inline void qsnapshot::hash ( unsigned long long &h, const void *p,
+	size_t n )
+{
+	const unsigned char *b = (const unsigned char *)p;
+	for ( size_t i = 0; i < n; ++i )
+		h = (h ^ b[i]) * 0x100000001b3ULL;
+}
+
+inline unsigned long long qsnapshot::key ( const quad_list &qlist,
+	const storage_type &mem )
+{
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	for ( size_t i = 0; i < qlist.size(); ++i )
+	{
+		const quad_type &q = qlist[i];
+		const char r[] = { q.op(), q.tron(), q.troff(), q.dump() };
+		hash ( h, r, sizeof(r) );
+		const qop *o[] = { &q.op1(), &q.op2(), &q.op3() };
+		for ( int k = 0; k < 3; ++k )
+		{
+			hash ( h, &o[k]->vtype, 1 );
+			hash ( h, &o[k]->adrmode, 1 );
+			// Only the bytes of the value's own type are set
+			if ( o[k]->vtype == 'f' )
+				hash ( h, &o[k]->val.f, sizeof(float) );
+			else
+				hash ( h, &o[k]->val.s, sizeof(label_type) );
+		}
+	}
+	hash ( h, mem.Image(), mem.Size() );
+	return h;
+}
+
+inline void qsnapshot::take ( const storage_type &mem, size_t pc,
+	adr_type gsize )
+{
+	m_map.close();
+	m_own.assign ( mem.Image(), mem.Image() + mem.Extent() );
+	m_image = &m_own[0];
+	m_size = mem.Extent();
+	m_pc = pc;
+	m_gsize = gsize;
+	m_top = mem.STop();
+	m_link = mem.DLink();
+	m_taken = true;
+}
+
+inline bool qsnapshot::save ( const char *fname,
+	unsigned long long key ) const
+{
+	qsnap_header h;
+	memset ( &h, 0, sizeof(h) );
+	memcpy ( h.magic, QSNAP_MAGIC, sizeof(h.magic) );
+	h.order = QSNAP_ORDER;
+	h.version = QSNAP_VERSION;
+	h.key = key;
+	h.memsize = m_size;
+	h.outsize = m_output.size();
+	h.pc = m_pc;
+	h.gsize = m_gsize;
+	h.top = m_top;
+	h.link = m_link;
+
+	ofstream os ( fname, ios::out | ios::binary | ios::trunc );
+	if ( !os ) return false;
+	os.write ( (const char *)&h, sizeof(h) );
+	os.write ( m_image, m_size );
+	os.write ( m_output.data(), m_output.size() );
+	os.close();
+	return bool ( os );
+}
+
+inline bool qsnapshot::load ( const char *fname, unsigned long long key,
+	size_t memsize )
+{
+	m_taken = false;
+	if ( !m_map.open ( fname ) ) return false;
+	qsnap_header h;
+	if ( m_map.size() < sizeof(h) ) return false;
+	memcpy ( &h, m_map.data(), sizeof(h) );
+	if ( memcmp ( h.magic, QSNAP_MAGIC, sizeof(h.magic) ) != 0
+		|| h.order != QSNAP_ORDER || h.version != QSNAP_VERSION
+		|| h.key != key || h.memsize != memsize
+		|| m_map.size() != sizeof(h) + h.memsize + h.outsize )
+		return false;
+
+	vector<char>().swap ( m_own );
+	m_image = m_map.data() + sizeof(h);
+	m_size = h.memsize;
+	m_output.assign ( m_image + h.memsize, h.outsize );
+	m_pc = h.pc;
+	m_gsize = h.gsize;
+	m_top = h.top;
+	m_link = h.link;
+	m_taken = true;
+	return true;
+}
+
+#endif // SNAPSHOT_H
@@ -10,34 +10,89 @@
 #include <iomanip>
 #include <cstddef>
 #include <cstring> // for memcpy
+#include <new>
 #include <string>
+#include <vector>
 #include <stdexcept>
 
 using namespace std;
 
-typedef unsigned short adr_type;	// Representation of emulated addresses
+// Representation of emulated addresses, of the integers that the machine
+// works with, and of quad numbers (labels).  Built with VMQ_WIDE, the
+// machine is wide: addresses and labels have 32 bits, and data memory may
+// be as large as --mem asks.  Integers stay 16-bit in both, so a frame
+// differs only in the size of the addresses in it.  Native code (jit.h,
+// aot.h) knows only the 16-bit machine.
+#ifdef VMQ_WIDE
+typedef unsigned int adr_type;
+typedef int label_type;
+#define MEM_MAX 0x7ffffffc	// so displacements reach all of it
+#define MEM_DEFAULT 0x1000000
+#define QUAD_MAX 0x7fffffff
+#else
+typedef unsigned short adr_type;
+typedef short label_type;
+#define MEM_MAX 0x7ffc		// largest possible multiple of 4
+#define MEM_DEFAULT MEM_MAX
+#define QUAD_MAX 0x7fff
+#endif
+typedef short word_type;
+
+// Data memory is the usable size asked for, with a guard region above
+// it.  The 16-bit machine's store spans its whole address range, so any
+// address it can form, however computed, lies in the store: above the
+// usable size it reads and writes the guard region, as scratch memory,
+// and never anything of the host's.  No engine reports such an access,
+// as native code could not without a check on every one; vmq's usage
+// says so.  (The wide machine checks its addresses instead; see
+// check_range.)  Past that is room for a float at the last address, and
+// a '\0' that ends any string in the store.
+#ifdef VMQ_WIDE
+#define STORE_SPAN(size) (size)
+#else
+#define STORE_SPAN(size) 0x10000
+#endif
+#define STORE_SLACK 8
+#define STORE_ALIGN 0x10000	// so an address is the low bits of a pointer
+
+// Keep rarely taken error paths out of line
+#ifdef __GNUC__
+#define COLD_PATH __attribute__((noinline, cold))
+#else
+#define COLD_PATH
+#endif
 
 
 class storage_type
 {
 public:
-	// Constructor.  Note that size must really be no more than SHRT_MAX,
+	// Constructor.  Note that size must really be no more than MEM_MAX,
 	// because of the range of adr_type, and because addresses can be
 	// represented in base-displacement form where the displacement
 	// is negative.
-	storage_type ( const size_t size ): m_size(size), m_top(size), m_link(size)
+	storage_type ( const size_t size ): m_size(size),
+		m_extent(STORE_SPAN(size) + STORE_SLACK), m_top(size), m_link(size)
 	{
-		m_store = new char[m_size];
+		m_store = (char *)::operator new[] ( m_extent,
+			align_val_t ( STORE_ALIGN ) );
+		memset ( m_store, 0, m_extent ); // so runs are repeatable
 	};
-	~storage_type ()	{ delete[] m_store; }
+	~storage_type ()
+		{ ::operator delete[] ( m_store, align_val_t ( STORE_ALIGN ) ); }
 
 //		Report
 	inline size_t Size ( void ) const { return m_size; };
+	// Bytes in the store, guard region and all
+	inline size_t Extent ( void ) const { return m_extent; };
+	// The whole of emulated memory, for saving its contents
+	inline const char *Image ( void ) const { return m_store; };
+	// ... and for native code (aot.h) to work on
+	inline char *Image ( void ) { return m_store; };
 
 //		Functions to access data of various types
 	inline char Char ( const adr_type adr ) const
 		{ return *l_byte ( adr ); };
-	inline short Short ( const adr_type adr ) const
+	inline word_type Short ( const adr_type adr ) const
 		{ return *l_short ( adr ); };
 	inline adr_type Adr ( const adr_type adr ) const
 		{ return *l_adr ( adr ); };
@@ -49,11 +104,20 @@ public:
 		}
 	inline char *Str ( const adr_type adr )
 		{ return l_str ( adr ); };
+	// n bytes from adr, for the block quads (block.h): they must lie
+	// wholly in data memory, and start at a multiple of mult
+	inline char *Block ( const adr_type adr, const size_t n,
+		const int mult ) const
+		{
+			check_align ( adr, mult );
+			if ( adr + n > m_size ) outside();
+			return &m_store[adr];
+		}
 
 //		Functions to write to emulated memory
 	inline void Set ( const adr_type adr, const char val )
 		{ *l_byte(adr) = val; };
-	inline void Set ( const adr_type adr, const short val )
+	inline void Set ( const adr_type adr, const word_type val )
 		{ *l_short(adr) = val; };
 	inline void Set ( const adr_type adr, const adr_type val )
 		{ *l_adr(adr) = val; };
@@ -64,21 +128,29 @@ public:
 	// Copy a string verbatim, not interpretting escape sequences
 	inline void Set ( const adr_type adr, const char *val, int n )
 		{
+			check_range ( adr, n );
+			if ( size_t(n) > room(adr) ) n = room(adr);
 			memcpy ( l_byte(adr), val, n );
 		};
 	// Copy a string, interpretting escape sequences
 	inline void Set ( const adr_type adr, const char * const val )
+		{ Set ( adr, val, val + strlen(val) ); }
+	// Copy the string from val up to end (or a '\0'), interpretting
+	// escape sequences
+	inline void Set ( const adr_type adr, const char *val,
+		const char *end )
 		{
 			const char *pv = val;
 			char *ps = l_str(adr);
+			char *const pe = ps + room(adr);
 			unsigned char c;
 			while ( true )
 			{
-				c = *pv++;
-				if ( !c ) { *ps = c; break; } // stop on '\0'
+				c = pv < end? *pv++: 0;
+				if ( !c || ps == pe ) { *ps = 0; break; } // stop on '\0'
 				if ( c == '\\' )
 				{
-					switch ( c = *pv++ )
+					switch ( c = pv < end? *pv++: 0 )
 					{
 					case '\\':
 					case 0:  c = '\\'; break; // '\\'
@@ -87,9 +159,11 @@ public:
 					case '0': // '\099'
 						{
 							unsigned short val = 0;
-							while ( (c = *pv++) && isdigit(c) )
+							while ( pv < end && (c = *pv) && isdigit(c) )
+							{
 								val = 8 * val + (unsigned short)c;
-							if (c) pv--; // put back non-digit
+								++pv;
+							}
 							c = val;
 						}
 						break;
@@ -100,18 +174,70 @@ public:
 			} // end while true
 		}
 
+//		Unchecked access, for addresses whose alignment was proved when
+//		the program was verified (see verify.h).  The wide machine still
+//		checks their range: base-relative operands and the stack reach
+//		past its store from a link or stack top the program can change.
+	inline word_type RawShort ( const adr_type adr ) const
+		{
+			check_range ( adr, sizeof(word_type) );
+			return *(word_type *)&m_store[adr];
+		};
+	inline adr_type RawAdr ( const adr_type adr ) const
+		{
+			check_range ( adr, sizeof(adr_type) );
+			return *(adr_type *)&m_store[adr];
+		};
+	inline float RawFloat ( const adr_type adr ) const
+		{
+			float f;
+			check_range ( adr, sizeof(float) );
+			memcpy ( &f, &m_store[adr], sizeof(float) );
+			return f;
+		}
+	inline void RawSet ( const adr_type adr, const word_type val )
+		{
+			check_range ( adr, sizeof(word_type) );
+			*(word_type *)&m_store[adr] = val;
+		};
+	inline void RawSet ( const adr_type adr, const adr_type val )
+		{
+			check_range ( adr, sizeof(adr_type) );
+			*(adr_type *)&m_store[adr] = val;
+		};
+	inline void RawSet ( const adr_type adr, const float val )
+		{
+			check_range ( adr, sizeof(float) );
+			memcpy ( &m_store[adr], &val, sizeof(float) );
+		};
+
+//		Take the contents and stack registers of memory of the same size
+	inline void Copy ( const storage_type &from )
+		{
+			memcpy ( m_store, from.m_store, m_extent );
+			m_top = from.m_top;
+			m_link = from.m_link;
+		}
+//		... or from an image of it (see snapshot.h)
+	inline void Copy ( const char *image, adr_type top, adr_type link )
+		{
+			memcpy ( m_store, image, m_extent );
+			m_top = top;
+			m_link = link;
+		}
+
 //		Runtime Stack functions
 	inline void Push ( const adr_type val )
 		{ m_top -= sizeof(adr_type); Set ( m_top, val ); }
-	inline void Push ( const short val )
-		{ m_top -= sizeof(short); Set ( m_top, val ); }
+	inline void Push ( const word_type val )
+		{ m_top -= sizeof(word_type); Set ( m_top, val ); }
 	inline void Push ( const float val )
 		{ m_top -= sizeof(float); Set ( m_top, val ); }
 	inline adr_type Pop_Adr ( void )
 		{ adr_type result = *l_adr(m_top); m_top += sizeof(adr_type);
 			return result; }
-	inline short Pop_Short ( void )
-		{ short result = *l_short(m_top); m_top += sizeof(short);
+	inline word_type Pop_Short ( void )
+		{ word_type result = *l_short(m_top); m_top += sizeof(word_type);
 			return result; }
 	inline float Pop_Float ( void )
 		{
@@ -123,6 +249,10 @@ public:
 	inline void Pop ( size_t n ) // Pop and discard n bytes (n even)
 		{ m_top += n; }
 
+	// Would pushing n bytes take the stack top below floor?
+	inline bool StackFull ( const size_t n, const adr_type floor ) const
+		{ return m_top < floor + n; }
+
 	// Build a new stack frame
 	inline void Link ( const size_t n )
 		{ Push ( m_link ); m_link = m_top; m_top -= n; }
@@ -131,59 +261,132 @@ public:
 	inline void UnLink ( void )
 		{ m_top = m_link; m_link = Pop_Adr(); }
 
+	// Unchecked stack functions, for verified programs, in which the
+	// stack top is always even
+	inline void RawPush ( const adr_type val )
+		{ m_top -= sizeof(adr_type); RawSet ( m_top, val ); }
+	inline void RawPush ( const float val )
+		{ m_top -= sizeof(float); RawSet ( m_top, val ); }
+	inline adr_type RawPop_Adr ( void )
+		{ adr_type result = RawAdr(m_top); m_top += sizeof(adr_type);
+			return result; }
+	inline void RawLink ( const size_t n )
+		{ RawPush ( m_link ); m_link = m_top; m_top -= n; }
+	inline void RawUnLink ( void )
+		{ m_top = m_link; m_link = RawPop_Adr(); }
+
 	// Access functions: Dynamic Link and Stack Top
 	inline adr_type DLink ( void ) const { return m_link; }
 	inline adr_type STop ( void ) const { return m_top; }
+	// The registers themselves, for native code (jit.h)
+	inline adr_type *TopReg ( void ) { return &m_top; }
+	inline adr_type *LinkReg ( void ) { return &m_link; }
+
+//		Functions to check proper usage of emulated memory
+	// Only the test is inline; the message is built when it fails
+	inline void check_align ( const adr_type adr, const int mult ) const
+	{
+		if ( adr & (mult - 1) ) misaligned ( mult );
+	}
+	// The wide machine's addresses reach far beyond its memory
+#ifdef VMQ_WIDE
+	inline void check_range ( const adr_type adr, const size_t n ) const
+	{
+		if ( adr + n > m_size ) outside();
+	}
+#else
+	inline void check_range ( const adr_type, const size_t ) const {}
+#endif
+	static COLD_PATH void outside ( void )
+	{
+		throw runtime_error ( "Address outside data memory" );
+	}
+	static COLD_PATH void misaligned ( const int mult )
+	{
+		const char name[] = "01234";
+		string msg =
+			"Unaligned data access, expecting multiple of ";
+		msg += name[mult];
+		throw runtime_error(msg);
+	}
 
 //		Debug
-	// Print contents of memory from adr1 to adr2 inclusive.  If 'stack'
-	// is true, print the stack limits and dynamic link register.
-	void Dump ( const adr_type adr1, const adr_type adr2, bool stack=false )
-		const
+	// Print contents of memory from adr1 to adr2 inclusive, 16 bytes to
+	// a row.  If 'stack' is true, print the stack limits and dynamic
+	// link register.  If rows is not 0, print only the rows it marks
+	// (or "(no change)" if it marks none).  A dump is formatted whole,
+	// then written at once.
+	void Dump ( const adr_type adr1, const adr_type adr2, bool stack=false,
+		ostream &os=cout, const vector<bool> *rows=0 ) const
 	{
-		const ios::fmtflags fmt = cout.flags();
-		const int oldfill = cout.fill('0');
-		int bytecount = 0;
-		adr_type dl = m_link; // mark the dynamic links in stack
+		static const char hex[] = "0123456789abcdef";
+		vector<adr_type> marks; // mark the dynamic links in stack
+		Marks ( adr1, adr2, marks );
+		size_t m = 0;
+		string out;
+		if ( !rows && adr1 <= adr2 )
+			out.reserve ( (size_t(adr2) - adr1 + 16) / 16 * 64 );
 
-		cout.setf(ios::hex, ios::basefield);
-		cout.setf(ios::internal, ios::adjustfield);
-		for (adr_type a=adr1; a <= adr2; a++ )
+		size_t r = 0;
+		for ( size_t a = adr1; a <= adr2; a += 16, ++r )
 		{
-			if ( bytecount % 16 == 0 )
-			{
-				cout.setf(ios::showbase);
-				if ( bytecount ) cout << "\n";
-				cout << setw(6) << a;
-				cout.unsetf(ios::showbase);
-			}
-			else if ( bytecount % 8 == 0 ) cout << "  ";
-			if ( (++bytecount) & 1 ) cout << " ";
-			if ( a == dl+1 )
+			while ( m < marks.size() && marks[m] < a ) ++m;
+			if ( rows && !(*rows)[r] ) continue;
+			if ( !out.empty() ) out += '\n';
+			// The address, as "0x%04x" (just "000000" for 0)
+			char num[24];
+			int n = 0;
+			for ( size_t v = a; v; v >>= 4 ) num[n++] = hex[v & 15];
+			if ( a ) out += "0x";
+			for ( int k = n + (a? 2: 0); k < 6; ++k ) out += '0';
+			while ( n ) out += num[--n];
+			for ( size_t k = 0; k < 16 && a + k <= adr2; ++k )
 			{
-				cout << "_"; dl = Adr(dl);
-			}
-			else cout << " ";
-//	Here, we should be able to simply do:
-//			cout << setw(2)
-//				<< (((unsigned short)m_store[a]) & 0xff);
-//	However, g++ 3.2 on Sun produces a program that segmentation faults
-//	if we do.  So, here's a work-around:
-			{
-				unsigned short data = m_store[a];
-				data &= 0xff;
-				if ( data < 0x10 ) cout << '0';
-				cout << data;
+				if ( k == 8 ) out += "  ";
+				if ( !(k & 1) ) out += ' ';
+				if ( m < marks.size() && marks[m] == a + k )
+					out += '_', ++m;
+				else
+					out += ' ';
+				const unsigned char data = m_store[a + k];
+				out += hex[data >> 4];
+				out += hex[data & 15];
 			}
 		}
-		cout << endl;
-		cout.setf(ios::showbase);
+		if ( rows && out.empty() ) out = "(no change)";
+		out += '\n';
+		os.write ( out.data(), out.size() );
+		os.flush();
+
 		if ( stack )
-			cout << "Stack: " << setw(6) << m_top << "->" << setw(6) << m_link
+		{
+			const ios::fmtflags fmt = os.flags();
+			const int oldfill = os.fill('0');
+			os.setf(ios::hex, ios::basefield);
+			os.setf(ios::internal, ios::adjustfield);
+			os.setf(ios::showbase);
+			os << "Stack: " << setw(6) << m_top << "->" << setw(6) << m_link
 				<< endl;
-		cout.fill(oldfill);
-		cout.flags ( fmt );
+			os.fill(oldfill);
+			os.flags ( fmt );
+		}
 	};
+	// The addresses from adr1 to adr2 that Dump marks: the byte after
+	// each dynamic link in the chain from the current one, while they
+	// rise
+	void Marks ( const adr_type adr1, const adr_type adr2,
+		vector<adr_type> &marks ) const
+	{
+		adr_type dl = m_link;
+		for ( size_t a = adr1; ; )
+		{
+			const size_t m = dl + 1;
+			if ( m < a || m > adr2 ) break;
+			marks.push_back ( m );
+			a = m + 1;
+			dl = Adr(dl);
+		}
+	}
 
 private:
 //		Function members
@@ -191,39 +394,38 @@ private:
 //		Functions to access data of various types
 	// "byte" may be used to access single elements of a string
 	inline char * l_byte ( const adr_type adr ) const
-		{ return &m_store[adr]; };
-	// "short" is for integers and quad numbers (labels)
-	inline short * l_short ( const adr_type adr ) const
-		{ check_align(adr, 2); return (short *)&m_store[adr]; };
+		{ check_range(adr, 1); return &m_store[adr]; };
+	// "short" is for integers and quad numbers (labels): word_type
+	inline word_type * l_short ( const adr_type adr ) const
+		{
+			check_align(adr, 2); check_range(adr, sizeof(word_type));
+			return (word_type *)&m_store[adr];
+		};
 	// "adr_type" is for addresses (pointers) to the emulated storage
 	inline adr_type * l_adr ( const adr_type adr ) const
-		{ check_align(adr, 2); return (adr_type *)&m_store[adr]; };
+		{
+			check_align(adr, 2); check_range(adr, sizeof(adr_type));
+			return (adr_type *)&m_store[adr];
+		};
 	// "float" is for floating point numbers
 	// The address may not be properly aligned for a float on some
 	// systems, so memcpy to/from this address to access
 	inline void * l_float ( const adr_type adr ) const
-		{ check_align(adr, 2); return (void *)&m_store[adr]; };
+		{
+			check_align(adr, 2); check_range(adr, sizeof(float));
+			return (void *)&m_store[adr];
+		};
 	// "str" is for character strings, terminated by '\0'
 	inline char * l_str ( const adr_type adr )
-		{ return &m_store[adr]; }
-
-//		Functions to check proper usage of emulated memory
-	void check_align ( const adr_type adr, const int mult ) const
-		throw (runtime_error)
-	{
-		const char name[] = "01234";
-		string msg =
-			"Unaligned data access, expecting multiple of ";
-		msg += name[mult];
-		if ( adr & (mult - 1) )
-		{
-			throw runtime_error(msg);
-		}
-	}
+		{ check_range(adr, 1); return &m_store[adr]; }
+	// Bytes a string at adr may take, short of the store's last '\0'
+	inline size_t room ( const adr_type adr ) const
+		{ return m_extent - 1 - adr; }
 
 //		Data members
 
 	size_t m_size; // Emulated memory size in bytes
+	size_t m_extent; // ... and of the store, with the guard region
 	char *m_store; // The emulated memory
 
 	// Runtime stack: the stack grows downward from the end of emulated
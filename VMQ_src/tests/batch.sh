@@ -0,0 +1,30 @@
+#!/bin/sh
+# batch.sh
+# Test of vmq --batch: a failing input in the middle of the list
+
+# div.q reads n and writes 100 / n.  Input d2 is 0, so its run stops
+# with an error; the runs of d1 and d3, either side of it, must still
+# write their output, and the summary must count the one failure.
+#
+# usage: sh tests/batch.sh [vmq]
+
+vmq=`cd \`dirname ${1:-./vmq}\` && pwd`/`basename ${1:-./vmq}`
+src=`cd \`dirname $0\`/batch && pwd`
+dir=`mktemp -d` || exit 1
+trap 'rm -rf "$dir"' 0
+
+cp "$src"/div.q "$src"/d1 "$src"/d2 "$src"/d3 "$src"/list "$dir"
+cd "$dir"
+
+fail ()
+{
+	echo "batch.sh: $*"
+	exit 1
+}
+
+"$vmq" --batch list div.q > log 2>&1 || fail "vmq exited with $?"
+[ "`cat d1.out`" = 20 ] || fail "wrong output for d1"
+[ "`cat d3.out`" = 5 ] || fail "wrong output for d3"
+grep -q "Division by zero" log || fail "no error reported for d2"
+grep -q "1 of 3 runs stopped with errors" log || fail "wrong summary"
+echo "batch.sh: passed"
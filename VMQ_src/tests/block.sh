@@ -0,0 +1,54 @@
+#!/bin/sh
+# block.sh
+# Test that every engine runs the block and vector quads alike
+
+# ops.q runs each of b w W v V u U t T, with blocks that overlap, n of 0
+# at an odd address, and base-relative blocks and counts, printing the
+# blocks after each.  The others each stop on one quad: a negative n,
+# given or read from memory (neg, negmem), an int block at an odd address
+# (oddfrom, oddto), and a block ending past data memory (range,
+# rangefrom) or past 0xFFFF (wrap).  The default (JIT), --nojit and AOT
+# engines must print what --switch does, errors included.  AOT is
+# skipped when there is no C compiler.
+#
+# usage: sh tests/block.sh [vmq]
+
+vmq=${1:-./vmq}
+src=`dirname $0`/block
+cc=${CC:-cc}
+dir=`mktemp -d` || exit 1
+trap 'rm -rf "$dir"' 0
+
+fail ()
+{
+	echo "block.sh: $*"
+	exit 1
+}
+
+# What a run printed from the start of the run on
+run ()
+{
+	"$vmq" $1 "$2" < /dev/null 2>&1 | sed -n '/^Running/,$p'
+}
+
+command -v "$cc" > /dev/null || echo "block.sh: no $cc; not testing AOT"
+for f in "$src"/*.q
+do
+	b=`basename $f .q`
+	want=`run --switch $f`
+	for engine in "" --nojit
+	do
+		[ "`run "$engine" $f`" = "$want" ] \
+			|| fail "$b.q ran differently with vmq $engine"
+	done
+	command -v "$cc" > /dev/null || continue
+	"$vmq" --aot "$dir"/$b.c $f < /dev/null > /dev/null 2>&1 \
+		|| fail "can't translate $b.q"
+	"$cc" -O2 -shared -fPIC -DVMQ_PLUGIN -o "$dir"/$b.so "$dir"/$b.c \
+		|| fail "can't compile the translation of $b.q"
+	"$vmq" --native "$dir"/$b.so $f < /dev/null 2>&1 \
+		| grep -q "Can't use" && fail "vmq won't load the translation of $b.q"
+	[ "`run "--native $dir/$b.so" $f`" = "$want" ] \
+		|| fail "$b.q ran differently when translated"
+done
+echo "block.sh: passed"
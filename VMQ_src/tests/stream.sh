@@ -0,0 +1,63 @@
+#!/bin/sh
+# stream.sh
+# Test of the array I/O pseudo-calls, and of the loops cVMQ makes of them
+
+# pseudo.q reads and writes runs of ints and floats with -4, -5, -12 and
+# -13: with a string, a newline or nothing after each element, with
+# counts of 0 and below, which do nothing, and past the end of the input,
+# which reads 0s.  Every engine must print pseudo.out.
+#
+# stream.q is what cVMQ makes of stream.cpp.  Its streaming loops are
+# rewritten as one pseudo-call each: the reads, the writes with " ",
+# endl and nothing after each element, and a loop whose count is below
+# 0, all of which must leave i where the loop would.  The loop in show(),
+# whose i and n are parameters, is compiled as written.  Every engine
+# must print stream.out.  Given cVMQ, the test also compiles stream.cpp
+# and compares the result with stream.q.
+#
+# usage: sh tests/stream.sh [vmq [cVMQ]]
+
+vmq=`cd \`dirname ${1:-./vmq}\` && pwd`/`basename ${1:-./vmq}`
+src=`cd \`dirname $0\`/stream && pwd`
+cvmq=$2
+cc=${CC:-cc}
+dir=`mktemp -d` || exit 1
+trap 'rm -rf "$dir"' 0
+
+fail ()
+{
+	echo "stream.sh: $*"
+	exit 1
+}
+
+for f in pseudo stream
+do
+	for engine in --switch --nojit ""
+	do
+		"$vmq" $engine "$src"/$f.q < "$src"/$f.in > "$dir"/out 2> /dev/null
+		cmp -s "$dir"/out "$src"/$f.out \
+			|| fail "$f.q ran wrongly with vmq $engine"
+	done
+	command -v "$cc" > /dev/null || continue
+	"$vmq" --aot "$dir"/$f.c "$src"/$f.q < /dev/null > /dev/null 2>&1 \
+		|| fail "can't translate $f.q"
+	"$cc" -O2 -shared -fPIC -DVMQ_PLUGIN -o "$dir"/$f.so "$dir"/$f.c \
+		|| fail "can't compile the translation of $f.q"
+	"$vmq" --native "$dir"/$f.so "$src"/$f.q < "$src"/$f.in \
+		> "$dir"/out 2> /dev/null
+	cmp -s "$dir"/out "$src"/$f.out \
+		|| fail "$f.q ran wrongly when translated"
+done
+
+if [ -n "$cvmq" ] && [ -x "$cvmq" ]
+then
+	cvmq=`cd \`dirname $cvmq\` && pwd`/`basename $cvmq`
+	cp "$src"/stream.cpp "$dir"
+	( cd "$dir" && "$cvmq" stream.cpp > /dev/null ) \
+		|| fail "cVMQ can't compile stream.cpp"
+	cmp -s "$dir"/stream.q "$src"/stream.q \
+		|| fail "cVMQ compiled stream.cpp differently"
+else
+	echo "stream.sh: no cVMQ; not compiling stream.cpp"
+fi
+echo "stream.sh: passed"
@@ -0,0 +1,74 @@
+#include <iostream>
+
+// Loops that stream an array in or out, and loops that only look like it
+
+int a[5];
+float f[3];
+int i, n;
+
+// i and n are parameters here, so the loop is compiled as written
+int show(int k, int m)
+{
+    while (k < m)
+    {
+        cout << a[k] << " ";
+        k += 1;
+    }
+    cout << endl;
+    return 0;
+}
+
+int main()
+{
+    n = 5;
+
+    i = 0;
+    while (i < n)
+    {
+        cin >> a[i];
+        i += 1;
+    }
+    cout << "i == " << i << endl;
+
+    i = 1;
+    while (i < n)
+    {
+        cout << a[i] << " ";
+        i = i + 1;
+    }
+    cout << endl;
+
+    i = 0;
+    while (i < 3)
+    {
+        cin >> f[i];
+        i = 1 + i;
+    }
+
+    i = 0;
+    while (i < 3)
+    {
+        cout << f[i] << endl;
+        i += 1;
+    }
+
+    i = 0;
+    while (i < n)
+    {
+        cout << a[i];
+        i += 1;
+    }
+    cout << endl;
+
+    i = 7;
+    while (i < n)
+    {
+        cout << a[i];
+        i += 1;
+    }
+    cout << "i == " << i << endl;
+
+    show(2, n);
+
+    return 0;
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# verify.sh
+# Test of the verifier's fallback to the fully checked engine
+
+# odd.q stores through an odd base-relative offset, range.q names an
+# absolute operand outside data memory, and label.q jumps to a label
+# outside the quad list.  None may run unchecked: the default and --nojit
+# engines must say the program was not verified, and must then run it
+# just as --switch does.  good.q, which passes, must not fall back.
+#
+# usage: sh tests/verify.sh [vmq]
+
+vmq=${1:-./vmq}
+src=`dirname $0`/verify
+note="Program not verified; running with all checks"
+
+fail ()
+{
+	echo "verify.sh: $*"
+	exit 1
+}
+
+# What a run printed from the start of the run on
+run ()
+{
+	"$vmq" $1 "$2" < /dev/null 2>&1 | sed -n '/^Running/,$p'
+}
+
+for f in odd range label
+do
+	want=`run --switch "$src"/$f.q`
+	for engine in "" --nojit
+	do
+		"$vmq" $engine "$src"/$f.q < /dev/null 2>&1 | grep -q "$note" \
+			|| fail "$f.q ran unchecked with vmq $engine"
+		[ "`run "$engine" "$src"/$f.q`" = "$want" ] \
+			|| fail "$f.q ran differently with vmq $engine"
+	done
+done
+"$vmq" "$src"/good.q < /dev/null 2>&1 | grep -q "$note" \
+	&& fail "good.q was not verified"
+echo "verify.sh: passed"
@@ -0,0 +1,27 @@
+#!/bin/sh
+# wide.sh
+# Test of vmq-wide: base-relative operands far outside data memory
+
+# far.q stores through a base-relative offset of 10^9, which is far past
+# the store.  Each engine must stop it with an error, not let it reach the
+# host's memory.
+#
+# usage: sh tests/wide.sh [vmq-wide]
+
+vmq=${1:-./vmq-wide}
+src=`dirname $0`/wide
+
+fail ()
+{
+	echo "wide.sh: $*"
+	exit 1
+}
+
+for engine in "" --nojit --switch
+do
+	log=`"$vmq" $engine "$src"/far.q < /dev/null 2>&1` \
+		|| fail "vmq-wide $engine exited with $?"
+	echo "$log" | grep -q "Address outside data memory" \
+		|| fail "no error reported by vmq-wide $engine"
+done
+echo "wide.sh: passed"
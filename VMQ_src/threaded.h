@@ -0,0 +1,1023 @@
+// threaded.h
+// Pre-decoded, threaded execution engine for the Compiler Theory Class
+// interpreter
+
+// Before execution, the quad list is translated into an array of decoded
+// quads, each holding a pointer to the routine (handler) that executes it
+// and its operands.  Handlers are instantiated from templates for every
+// combination of opcode and addressing modes, so an operand fetch is
+// compiled for its mode rather than decoded at run time.  Labels are
+// checked and resolved once, and each pseudo-call number gets a handler
+// of its own.  A handler ends by passing control directly to the handler
+// of the next quad (tail-call threading) when the compiler is optimizing;
+// otherwise handlers return the next quad to a small loop.
+
+// The engine runs only programs that passed qverifier (verify.h), so
+// absolute and base-relative operands and the runtime stack are accessed
+// without alignment checks; only computed (indirect) addresses are
+// checked.
+
+#ifndef THREADED_H
+#define THREADED_H
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include "storage.h"
+#include "quad.h"
+#include "output.h"
+#include "input.h"
+#include "block.h"
+
+using namespace std;
+
+// Threading by tail calls relies on the compiler turning "return f(...)"
+// into a jump, which g++ does only when optimizing.  #define
+// NO_TAIL_CALLS to force the dispatch loop.
+#if defined(__GNUC__) && defined(__OPTIMIZE__) && !defined(NO_TAIL_CALLS)
+#define TAIL_THREADED
+#endif
+
+// Decoded addressing modes (see qop::adrmode).  Modes that can form an
+// l-value come first, and float operands use only the first five.
+enum
+{
+	AM_DIR,		// ' ' absolute, normal
+	AM_IND,		// '@' absolute, indirect
+	AM_REL,		// '_' base-relative, normal
+	AM_RELIND,	// 'N' base-relative, indirect
+	AM_IMM,		// '#' immediate; also 'M' for float operands
+	AM_RELIMM,	// 'M' base-relative, immediate
+
+	AM_LVALS = AM_IMM,	// number of l-value modes
+	AM_FLOATS = AM_RELIMM,	// number of float operand modes
+	AM_ALL
+};
+
+struct dquad_type;
+struct thread_state;
+
+// A handler executes one decoded quad, then continues with the next.
+// It returns 0 when the machine halts.
+typedef const dquad_type *(*handler_type)
+	( const dquad_type *ip, thread_state &st );
+
+// A decoded quad.  For labels, v1..v3 hold the index of the target
+// quad, already checked against the size of the program.
+struct dquad_type
+{
+	handler_type h;
+	opval v1, v2, v3;
+	unsigned char m1, m2, m3;	// AM_ codes
+};
+
+// Machine state shared by the handlers
+struct thread_state
+{
+	thread_state ( storage_type &m, const dquad_type *c, size_t n )
+		: mem(m), code(c), pc(c), nquads(n), gsize(0), running(false),
+		  paused(false), counts(0), handlers(0) {}
+
+	storage_type &mem;
+	const dquad_type *code;	// decoded quad 0
+	const dquad_type *pc;	// quad being executed, for error reports
+	size_t nquads;
+	adr_type gsize;	// size of global data area
+	bool running;	// record when a '$' has been executed
+	bool paused;	// stopped before a read at st.pc, as qin is held
+
+	// When profiling, quads whose handler is exec_probe add one to their
+	// count, then run their own handler
+	unsigned long long *counts;
+	const handler_type *handlers;
+};
+
+// Errors that must terminate the run immediately (ERR_FATAL)
+class fatal_error: public runtime_error
+{
+public:
+	fatal_error ( const string &msg ): runtime_error ( msg ) {}
+};
+
+#ifdef TAIL_THREADED
+#define NEXT(n) \
+	do { const dquad_type *nx_ = (n); st.pc = nx_; \
+		return nx_->h ( nx_, st ); } while (0)
+#else
+#define NEXT(n) do { (void) st; return (n); } while (0)
+#endif
+
+// Operand access.  Memory operands yield an effective address; r-values
+// of each type are formed as qop::sval, cval, fval and aval would.
+// Handlers pass their addressing modes as constants, so each switch
+// below folds away once inlined.  The pointer an indirect operand goes
+// through has a verified address; the address it holds does not.
+#ifdef __GNUC__
+#define OPERAND_INLINE inline __attribute__((always_inline))
+#else
+#define OPERAND_INLINE inline
+#endif
+
+OPERAND_INLINE adr_type d_ea ( const opval &v, unsigned char m,
+	const storage_type &mem )
+{
+	switch ( m )
+	{
+	case AM_IND: return mem.RawAdr ( v.a );
+	case AM_REL: return adr_type ( mem.DLink() + v.s );
+	case AM_RELIND: return mem.RawAdr ( adr_type ( mem.DLink() + v.s ) );
+	default: return v.a;
+	}
+}
+
+OPERAND_INLINE word_type d_sval ( const opval &v, unsigned char m,
+	const storage_type &mem )
+{
+	switch ( m )
+	{
+	case AM_IMM: return v.s;
+	case AM_RELIMM: return word_type ( mem.DLink() + v.s );
+	case AM_IND: case AM_RELIND: return mem.Short ( d_ea ( v, m, mem ) );
+	default: return mem.RawShort ( d_ea ( v, m, mem ) );
+	}
+}
+
+OPERAND_INLINE char d_cval ( const opval &v, unsigned char m,
+	const storage_type &mem )
+{
+	switch ( m )
+	{
+	case AM_IMM: return char ( v.s );
+	case AM_RELIMM: return char ( mem.DLink() + v.s );
+	default: return mem.Char ( d_ea ( v, m, mem ) );
+	}
+}
+
+OPERAND_INLINE float d_fval ( const opval &v, unsigned char m,
+	const storage_type &mem )
+{
+	switch ( m )
+	{
+	case AM_IMM: return v.f;
+	case AM_IND: case AM_RELIND: return mem.Float ( d_ea ( v, m, mem ) );
+	default: return mem.RawFloat ( d_ea ( v, m, mem ) );
+	}
+}
+
+OPERAND_INLINE adr_type d_aval ( const opval &v, unsigned char m,
+	const storage_type &mem )
+{
+	switch ( m )
+	{
+	case AM_IMM: return v.a;
+	case AM_RELIMM: return adr_type ( mem.DLink() + v.s );
+	case AM_IND: case AM_RELIND: return mem.Adr ( d_ea ( v, m, mem ) );
+	default: return mem.RawAdr ( d_ea ( v, m, mem ) );
+	}
+}
+
+// Store a result at the effective address of an l-value operand
+template <class T>
+OPERAND_INLINE void d_set ( storage_type &mem, adr_type a, unsigned char m,
+	T val )
+{
+	if ( m == AM_IND || m == AM_RELIND ) mem.Set ( a, val );
+	else mem.RawSet ( a, val );
+}
+
+// Handlers.  Each family is a class whose member template exec is
+// instantiated for the addressing modes of the first, second and third
+// operands.
+
+// 3 address integer quads
+template <char OP>
+struct int3_quad
+{
+	template <int M1, int M2, int M3>
+	static const dquad_type *exec ( const dquad_type *ip, thread_state &st )
+	{
+		storage_type &mem = st.mem;
+		const adr_type res_adr = d_ea ( ip->v3, M3, mem );
+		const word_type x = d_sval ( ip->v1, M1, mem );
+		const word_type y = d_sval ( ip->v2, M2, mem );
+		if ( (OP == 'd' || OP == 'r') && y == 0 )
+			throw runtime_error ( "Division by zero: STOP" );
+		switch ( OP )
+		{
+		case 'a': d_set ( mem, res_adr, M3, word_type ( x + y ) ); break;
+		case 's': d_set ( mem, res_adr, M3, word_type ( x - y ) ); break;
+		case 'm': d_set ( mem, res_adr, M3, word_type ( x * y ) ); break;
+		case 'd': d_set ( mem, res_adr, M3, word_type ( x / y ) ); break;
+		case 'r': d_set ( mem, res_adr, M3, word_type ( x % y ) ); break;
+		case '|': d_set ( mem, res_adr, M3, word_type ( x | y ) ); break;
+		case '&': d_set ( mem, res_adr, M3, word_type ( x & y ) ); break;
+		}
+		NEXT ( ip + 1 );
+	}
+};
+
+// 3 address float quads
+template <char OP>
+struct flt3_quad
+{
+	template <int M1, int M2, int M3>
+	static const dquad_type *exec ( const dquad_type *ip, thread_state &st )
+	{
+		storage_type &mem = st.mem;
+		const adr_type res_adr = d_ea ( ip->v3, M3, mem );
+		const float x = d_fval ( ip->v1, M1, mem );
+		const float y = d_fval ( ip->v2, M2, mem );
+		switch ( OP )
+		{
+		case 'A': d_set ( mem, res_adr, M3, float ( x + y ) ); break;
+		case 'S': d_set ( mem, res_adr, M3, float ( x - y ) ); break;
+		case 'M': d_set ( mem, res_adr, M3, float ( x * y ) ); break;
+		case 'D': d_set ( mem, res_adr, M3, float ( x / y ) ); break;
+		}
+		NEXT ( ip + 1 );
+	}
+};
+
+// Conditional branches on integers
+template <char OP>
+struct ibranch_quad
+{
+	template <int M1, int M2, int M3>
+	static const dquad_type *exec ( const dquad_type *ip, thread_state &st )
+	{
+		const word_type x = d_sval ( ip->v1, M1, st.mem );
+		const word_type y = d_sval ( ip->v2, M2, st.mem );
+		bool take = false;
+		switch ( OP )
+		{
+		case 'l': take = x < y; break;
+		case 'g': take = x > y; break;
+		case 'e': take = x == y; break;
+		}
+		if ( take ) NEXT ( st.code + ip->v3.s );
+		NEXT ( ip + 1 );
+	}
+};
+
+// Conditional branches on floats
+template <char OP>
+struct fbranch_quad
+{
+	template <int M1, int M2, int M3>
+	static const dquad_type *exec ( const dquad_type *ip, thread_state &st )
+	{
+		const float x = d_fval ( ip->v1, M1, st.mem );
+		const float y = d_fval ( ip->v2, M2, st.mem );
+		bool take = false;
+		switch ( OP )
+		{
+		case 'L': take = x < y; break;
+		case 'G': take = x > y; break;
+		case 'E': take = x == y; break;
+		}
+		if ( take ) NEXT ( st.code + ip->v3.s );
+		NEXT ( ip + 1 );
+	}
+};
+
+// 2 address quads
+template <char OP>
+struct two_quad
+{
+	template <int M1, int M2, int M3>
+	static const dquad_type *exec ( const dquad_type *ip, thread_state &st )
+	{
+		storage_type &mem = st.mem;
+		const adr_type res_adr = d_ea ( ip->v2, M2, mem );
+		switch ( OP )
+		{
+		case 'i': d_set ( mem, res_adr, M2, d_sval ( ip->v1, M1, mem ) );
+			break;
+		case 'I': d_set ( mem, res_adr, M2, d_fval ( ip->v1, M1, mem ) );
+			break;
+		case '=': mem.Set ( res_adr, d_cval ( ip->v1, M1, mem ) ); break;
+		case 'F': d_set ( mem, res_adr, M2,
+				float ( d_sval ( ip->v1, M1, mem ) ) );
+			break;
+		case 'f': d_set ( mem, res_adr, M2,
+				word_type ( d_fval ( ip->v1, M1, mem ) ) );
+			break;
+		case '~': d_set ( mem, res_adr, M2,
+				word_type ( ~d_sval ( ip->v1, M1, mem ) ) );
+			break;
+		case 'n': d_set ( mem, res_adr, M2,
+				word_type ( -d_sval ( ip->v1, M1, mem ) ) );
+			break;
+		case 'N': d_set ( mem, res_adr, M2,
+				float ( -d_fval ( ip->v1, M1, mem ) ) );
+			break;
+		}
+		NEXT ( ip + 1 );
+	}
+};
+
+// Bodies shared by the handlers of single quads and superinstructions
+// below; q is the decoded quad whose operands they use.
+
+// Push parameter q->v1 (a 'p' or 'P' quad)
+template <char OP, int M>
+OPERAND_INLINE void d_push ( const dquad_type *q, thread_state &st )
+{
+	storage_type &mem = st.mem;
+	// Check for stack overflow
+	if ( mem.StackFull ( OP=='p'? sizeof(adr_type): 4, st.gsize ) )
+		throw fatal_error ( "Stack Overflow" );
+	if ( OP == 'p' )
+		mem.RawPush ( d_aval ( q->v1, M, mem ) );
+	else
+		mem.RawPush ( d_fval ( q->v1, M, mem ) );
+}
+
+// Call the function at label q->v2, returning to the quad after q; the
+// result is the quad to continue with
+template <int M>
+OPERAND_INLINE const dquad_type *d_call ( const dquad_type *q,
+	thread_state &st )
+{
+	storage_type &mem = st.mem;
+	// push result address and return address
+	mem.RawPush ( d_aval ( q->v1, M, mem ) );
+	mem.RawPush ( adr_type ( q - st.code + 1 ) );
+	return st.code + q->v2.s;
+}
+
+// Pseudo-calls to do I/O--the variable to be set or printed is on top
+// of the stack.  The array calls take the first element there, the number
+// of elements under it, and for a write, under that, the address of a
+// string to write after each element; a number not above 0 does nothing.
+template <int FN>
+inline void d_pseudo ( storage_type &mem )
+{
+	const adr_type arg = mem.RawAdr ( mem.STop() );
+	switch ( FN )
+	{
+	case -1: // Read int
+		{
+			word_type x;
+			qin.get ( x );
+			mem.Set ( arg, x );
+		}
+		break;
+	case -2: // Read float
+		{
+			float x;
+			qin.get ( x );
+			mem.Set ( arg, x );
+		}
+		break;
+	case -3: // Read character line
+		{
+			string x;
+			qin.getline ( x );
+			x += '\n';
+			mem.Set ( arg, x.c_str(), x.length()+1 );
+		}
+		break;
+	case -4: // Read int array
+		{
+			const word_type n = mem.Short ( mem.STop() + sizeof(adr_type) );
+			for ( word_type k = 0; k < n; ++k )
+			{
+				word_type x;
+				qin.get ( x );
+				mem.Set ( adr_type ( arg + k * sizeof(word_type) ), x );
+			}
+		}
+		break;
+	case -5: // Read float array
+		{
+			const word_type n = mem.Short ( mem.STop() + sizeof(adr_type) );
+			for ( word_type k = 0; k < n; ++k )
+			{
+				float x;
+				qin.get ( x );
+				mem.Set ( adr_type ( arg + k * sizeof(float) ), x );
+			}
+		}
+		break;
+	case -9: // Write int
+		qout.put ( mem.Short ( arg ) );
+		break;
+	case -10: // Write float
+		qout.put ( mem.Float ( arg ) );
+		break;
+	case -11: // Write string
+		qout.put ( mem.Str ( arg ) );
+		break;
+	case -12: // Write int array
+		{
+			const word_type n = mem.Short ( mem.STop() + sizeof(adr_type) );
+			const adr_type sep = mem.Adr ( mem.STop() + 2*sizeof(adr_type) );
+			for ( word_type k = 0; k < n; ++k )
+			{
+				qout.put ( mem.Short (
+					adr_type ( arg + k * sizeof(word_type) ) ) );
+				qout.put ( mem.Str ( sep ) );
+			}
+		}
+		break;
+	case -13: // Write float array
+		{
+			const word_type n = mem.Short ( mem.STop() + sizeof(adr_type) );
+			const adr_type sep = mem.Adr ( mem.STop() + 2*sizeof(adr_type) );
+			for ( word_type k = 0; k < n; ++k )
+			{
+				qout.put ( mem.Float (
+					adr_type ( arg + k * sizeof(float) ) ) );
+				qout.put ( mem.Str ( sep ) );
+			}
+		}
+		break;
+	}
+}
+
+// Block and vector quads (block.h).  The work outweighs the decoding of
+// the operands, so these read them by the modes the decoded quad holds,
+// rather than by modes compiled in.  The destination is evaluated first,
+// as for other quads, then the first operand, then the count.
+template <char OP>
+inline void d_block ( const dquad_type *q, storage_type &mem )
+{
+	const adr_type to = d_ea ( q->v3, q->m3, mem );
+	switch ( OP )
+	{
+	case 'w':
+		{
+			const word_type x = d_sval ( q->v1, q->m1, mem );
+			block_fill ( mem, x, d_sval ( q->v2, q->m2, mem ), to );
+		}
+		break;
+	case 'W':
+		{
+			const float x = d_fval ( q->v1, q->m1, mem );
+			block_fill ( mem, x, d_sval ( q->v2, q->m2, mem ), to );
+		}
+		break;
+	default:
+		{
+			const adr_type from = d_ea ( q->v1, q->m1, mem );
+			const word_type n = d_sval ( q->v2, q->m2, mem );
+			block_run ( mem, OP, from, n, to );
+		}
+		break;
+	}
+}
+
+// Stop before a read, at quad ip, while qin is held
+inline const dquad_type *d_pause ( const dquad_type *ip, thread_state &st )
+{
+	st.pc = ip;
+	st.paused = true;
+	return 0;
+}
+
+// Pseudo-call FN for native code (jit.h, aot.h).  Returns nonzero,
+// having done nothing, if the I/O would fail on a misaligned variable,
+// or if it is a read and qin is held.  (The elements of an array after
+// the first are aligned as it is, and wrap around the 16-bit store.)
+template <int FN>
+int native_pseudo ( storage_type *mem )
+{
+	if ( FN >= -5 && qin.held() ) return 1;
+	const adr_type arg = mem->RawAdr ( mem->STop() );
+	if ( FN != -3 && FN != -11 && (arg & 1) ) return 1;
+	d_pseudo<FN> ( *mem );
+	return 0;
+}
+
+// Block quad q for native code (jit.h).  Returns nonzero, having done
+// nothing, if it would raise an error.
+template <char OP>
+int native_block ( storage_type *mem, const dquad_type *q )
+{
+	try
+	{
+		d_block<OP> ( q, *mem );
+	}
+	catch ( runtime_error & )
+	{
+		return 1;
+	}
+	return 0;
+}
+
+// Function call
+struct call_quad
+{
+	template <int M1, int M2, int M3>
+	static const dquad_type *exec ( const dquad_type *ip, thread_state &st )
+	{
+		NEXT ( d_call<M1> ( ip, st ) );
+	}
+};
+
+// Push parameter
+template <char OP>
+struct push_quad
+{
+	template <int M1, int M2, int M3>
+	static const dquad_type *exec ( const dquad_type *ip, thread_state &st )
+	{
+		d_push<OP, M1> ( ip, st );
+		NEXT ( ip + 1 );
+	}
+};
+
+// Pseudo-call
+template <int FN>
+const dquad_type *exec_pseudo ( const dquad_type *ip, thread_state &st )
+{
+	if ( FN >= -5 && qin.held() ) return d_pause ( ip, st );
+	d_pseudo<FN> ( st.mem );
+	NEXT ( ip + 1 );
+}
+
+// Superinstructions.  The decoder gives the first quad of a sequence that
+// cVMQ emits often a handler that executes the whole sequence.  The quads
+// after it keep their own handlers, so a jump into the middle of the
+// sequence still works.  A superinstruction takes the operands of later
+// quads from their own decoded entries, and moves st.pc along so that an
+// error is reported at the quad that caused it.
+
+// p x / c 0 FN / ^ n: one item of input or output
+template <int FN>
+struct io_seq
+{
+	template <int M1, int M2, int M3>
+	static const dquad_type *exec ( const dquad_type *ip, thread_state &st )
+	{
+		if ( FN >= -5 && qin.held() ) return d_pause ( ip, st );
+		d_push<'p', M1> ( ip, st );
+		st.pc = ip + 1;
+		d_pseudo<FN> ( st.mem );
+		st.pc = ip + 2;
+		st.mem.Pop ( ip[2].v1.s ); // verified even
+		NEXT ( ip + 3 );
+	}
+};
+
+// m i #size t / a base t t: address of an array element.  M1 is the mode
+// of i, M2 that of base, M3 that of t.
+struct index_seq
+{
+	template <int M1, int M2, int M3>
+	static const dquad_type *exec ( const dquad_type *ip, thread_state &st )
+	{
+		storage_type &mem = st.mem;
+		adr_type res_adr = d_ea ( ip->v3, M3, mem );
+		d_set ( mem, res_adr, M3,
+			word_type ( d_sval ( ip->v1, M1, mem ) * ip->v2.s ) );
+		st.pc = ip + 1;
+		res_adr = d_ea ( ip->v3, M3, mem );
+		const word_type x = d_sval ( ip[1].v1, M2, mem );
+		const word_type y = d_sval ( ip->v3, M3, mem );
+		d_set ( mem, res_adr, M3, word_type ( x + y ) );
+		NEXT ( ip + 2 );
+	}
+};
+
+// p x / p y: two parameters
+struct push2_seq
+{
+	template <int M1, int M2, int M3>
+	static const dquad_type *exec ( const dquad_type *ip, thread_state &st )
+	{
+		d_push<'p', M1> ( ip, st );
+		st.pc = ip + 1;
+		d_push<'p', M2> ( ip + 1, st );
+		NEXT ( ip + 2 );
+	}
+};
+
+// p x / c r f: the last parameter and the call.  M2 is the mode of r.
+struct pushcall_seq
+{
+	template <int M1, int M2, int M3>
+	static const dquad_type *exec ( const dquad_type *ip, thread_state &st )
+	{
+		d_push<'p', M1> ( ip, st );
+		st.pc = ip + 1;
+		NEXT ( d_call<M2> ( ip + 1, st ) );
+	}
+};
+
+// Pseudo-call to a number that has no I/O function
+inline const dquad_type *exec_badpseudo ( const dquad_type *,
+	thread_state & )
+{
+	throw runtime_error ( "Unrecognized pseudo-quad number: STOP" );
+}
+
+// Initialize runtime environment
+inline const dquad_type *exec_start ( const dquad_type *ip, thread_state &st )
+{
+	if ( st.running )
+		throw runtime_error ( "'$' Quad may only be executed once: STOP" );
+	st.running = true;
+	st.gsize = ip->v2.s;
+	NEXT ( st.code + ip->v1.s );
+}
+
+inline const dquad_type *exec_jump ( const dquad_type *ip, thread_state &st )
+{
+	NEXT ( st.code + ip->v1.s );
+}
+
+// Create stack frame
+inline const dquad_type *exec_link ( const dquad_type *ip, thread_state &st )
+{
+	st.mem.RawLink ( ip->v1.s );
+	NEXT ( ip + 1 );
+}
+
+// Pop runtime stack
+inline const dquad_type *exec_pop ( const dquad_type *ip, thread_state &st )
+{
+	const size_t n = ip->v1.s;
+	if ( n & 0x0001 )
+		throw runtime_error ( "Must pop an even number of bytes: STOP" );
+	st.mem.Pop ( n );
+	NEXT ( ip + 1 );
+}
+
+// Return from function
+inline const dquad_type *exec_return ( const dquad_type *,
+	thread_state &st )
+{
+	storage_type &mem = st.mem;
+	mem.RawUnLink();
+	size_t target = mem.RawPop_Adr();
+	(void) mem.RawPop_Adr(); // Pop adr of return value
+	// The restored link came from memory the program could overwrite;
+	// base-relative operands are unchecked only while it stays even
+	mem.check_align ( mem.DLink(), 2 );
+	if ( target > st.nquads ) target = st.nquads;
+	NEXT ( st.code + target );
+}
+
+inline const dquad_type *exec_halt ( const dquad_type *, thread_state & )
+{
+	return 0;
+}
+
+inline const dquad_type *exec_probe ( const dquad_type *ip,
+	thread_state &st )
+{
+	++st.counts[ip - st.code];
+	return st.handlers[ip - st.code] ( ip, st );
+}
+
+inline const dquad_type *exec_noop ( const dquad_type *ip, thread_state &st )
+{
+	NEXT ( ip + 1 );
+}
+
+// Block and vector quads
+template <char OP>
+const dquad_type *exec_block ( const dquad_type *ip, thread_state &st )
+{
+	d_block<OP> ( ip, st.mem );
+	NEXT ( ip + 1 );
+}
+
+// Stands one past the last quad, and for every label outside the program
+inline const dquad_type *exec_offend ( const dquad_type *,
+	thread_state & )
+{
+	throw runtime_error ( "Control passed outside the quad list: STOP" );
+}
+
+inline const dquad_type *exec_badop ( const dquad_type *, thread_state & )
+{
+	throw runtime_error ( "Unrecognized opcode" );
+}
+
+// For an immediate destination, which the loader does not let through
+inline const dquad_type *exec_badlval ( const dquad_type *,
+	thread_state & )
+{
+	throw runtime_error ( "Illegal use of l-value" );
+}
+
+#undef NEXT
+
+// Table of the handlers of one family, F, for N1 x N2 x N3 combinations
+// of operand addressing modes.  table_fill instantiates F::exec for each
+// combination by recursion over the flattened index.
+template <class F, int N2, int N3, int I>
+struct table_fill
+{
+	static void go ( handler_type *t )
+	{
+		table_fill<F, N2, N3, I-1>::go ( t );
+		t[I-1] = &F::template exec<(I-1)/(N2*N3), (I-1)/N3%N2, (I-1)%N3>;
+	}
+};
+
+template <class F, int N2, int N3>
+struct table_fill<F, N2, N3, 0>
+{
+	static void go ( handler_type * ) {}
+};
+
+template <class F, int N1, int N2, int N3>
+class mode_table
+{
+public:
+	mode_table ( void ) { table_fill<F, N2, N3, N1*N2*N3>::go ( m_h ); }
+
+	// Handler for the given modes, or 0 if a mode is out of range
+	handler_type operator () ( int m1, int m2 = 0, int m3 = 0 ) const
+	{
+		if ( m1 >= N1 || m2 >= N2 || m3 >= N3 ) return 0;
+		return m_h[(m1 * N2 + m2) * N3 + m3];
+	}
+
+private:
+	handler_type m_h[N1*N2*N3];
+};
+
+// Translate a quad list into decoded quads.  The result has one decoded
+// quad per quad, plus the end marker.
+class qdecoder
+{
+public:
+	qdecoder ( const quad_list &qlist, vector<dquad_type> &code,
+		bool super = true )
+		: m_qlist(qlist), m_code(code), m_super(super) {}
+	void go ( void );
+
+private:
+	static unsigned char mode ( const qop &q );
+	static bool same ( const qop &a, const qop &b );
+	label_type label ( const qop &q ) const;
+	handler_type handler ( const quad_type &q ) const;
+	handler_type superinstruction ( size_t i ) const;
+
+	const quad_list &m_qlist;
+	vector<dquad_type> &m_code;
+	bool m_super;	// use superinstructions
+};
+
+inline void qdecoder::go ( void )
+{
+	const size_t nquads = m_qlist.size();
+	m_code.resize ( nquads + 1 );
+	for ( size_t i = 0; i < nquads; ++i )
+	{
+		const quad_type &q = m_qlist[i];
+		dquad_type &d = m_code[i];
+		d.h = handler ( q );
+		d.v1 = q.op1().val; d.m1 = mode ( q.op1() );
+		d.v2 = q.op2().val; d.m2 = mode ( q.op2() );
+		d.v3 = q.op3().val; d.m3 = mode ( q.op3() );
+		switch ( q.op() )
+		{
+		case 'l': case 'L': case 'g': case 'G': case 'e': case 'E':
+			d.v3.s = label ( q.op3() );
+			break;
+		case 'c':
+			if ( q.op2().val.s >= 0 ) d.v2.s = label ( q.op2() );
+			break;
+		case '$':
+			d.v1.s = label ( q.op1() );
+			break;
+		case 'j':
+			d.v1.s = label ( q.op1() );
+			break;
+		}
+	}
+	m_code[nquads].h = exec_offend;
+
+	// Replace the handlers of quads that begin common sequences
+	for ( size_t i = 0; m_super && i < nquads; ++i )
+	{
+		const handler_type h = superinstruction ( i );
+		if ( h ) m_code[i].h = h;
+	}
+}
+
+inline unsigned char qdecoder::mode ( const qop &q )
+{
+	switch ( q.adrmode )
+	{
+	case '@': return AM_IND;
+	case '#': return AM_IMM;
+	case '_': return AM_REL;
+	case 'N': return AM_RELIND;
+	case 'M': return q.vtype == 'f' ? AM_IMM : AM_RELIMM;
+	default: return AM_DIR;
+	}
+}
+
+// Do two operands designate the same thing?
+inline bool qdecoder::same ( const qop &a, const qop &b )
+{
+	return a.adrmode == b.adrmode && a.vtype == b.vtype && a.val.s == b.val.s;
+}
+
+// Labels outside the program refer to the end marker
+inline label_type qdecoder::label ( const qop &q ) const
+{
+	if ( q.val.s < 0 || size_t ( q.val.s ) >= m_qlist.size() )
+		return label_type ( m_qlist.size() );
+	return q.val.s;
+}
+
+// Choose the handler specialized for the opcode and addressing modes
+inline handler_type qdecoder::handler ( const quad_type &q ) const
+{
+	// Tables by family; the last mode index of 3 address quads is the
+	// destination, and that of 2 address quads the second operand
+	typedef mode_table<int3_quad<'a'>, AM_ALL, AM_ALL, AM_LVALS> a_table;
+	typedef mode_table<int3_quad<'s'>, AM_ALL, AM_ALL, AM_LVALS> s_table;
+	typedef mode_table<int3_quad<'m'>, AM_ALL, AM_ALL, AM_LVALS> m_table;
+	typedef mode_table<int3_quad<'d'>, AM_ALL, AM_ALL, AM_LVALS> d_table;
+	typedef mode_table<int3_quad<'r'>, AM_ALL, AM_ALL, AM_LVALS> r_table;
+	typedef mode_table<int3_quad<'|'>, AM_ALL, AM_ALL, AM_LVALS> or_table;
+	typedef mode_table<int3_quad<'&'>, AM_ALL, AM_ALL, AM_LVALS> and_table;
+	typedef mode_table<flt3_quad<'A'>, AM_FLOATS, AM_FLOATS, AM_LVALS>
+		fa_table;
+	typedef mode_table<flt3_quad<'S'>, AM_FLOATS, AM_FLOATS, AM_LVALS>
+		fs_table;
+	typedef mode_table<flt3_quad<'M'>, AM_FLOATS, AM_FLOATS, AM_LVALS>
+		fm_table;
+	typedef mode_table<flt3_quad<'D'>, AM_FLOATS, AM_FLOATS, AM_LVALS>
+		fd_table;
+	typedef mode_table<ibranch_quad<'l'>, AM_ALL, AM_ALL, 1> l_table;
+	typedef mode_table<ibranch_quad<'g'>, AM_ALL, AM_ALL, 1> g_table;
+	typedef mode_table<ibranch_quad<'e'>, AM_ALL, AM_ALL, 1> e_table;
+	typedef mode_table<fbranch_quad<'L'>, AM_FLOATS, AM_FLOATS, 1> fl_table;
+	typedef mode_table<fbranch_quad<'G'>, AM_FLOATS, AM_FLOATS, 1> fg_table;
+	typedef mode_table<fbranch_quad<'E'>, AM_FLOATS, AM_FLOATS, 1> fe_table;
+	typedef mode_table<two_quad<'i'>, AM_ALL, AM_LVALS, 1> i_table;
+	typedef mode_table<two_quad<'I'>, AM_FLOATS, AM_LVALS, 1> fi_table;
+	typedef mode_table<two_quad<'='>, AM_ALL, AM_LVALS, 1> eq_table;
+	typedef mode_table<two_quad<'F'>, AM_ALL, AM_LVALS, 1> ff_table;
+	typedef mode_table<two_quad<'f'>, AM_FLOATS, AM_LVALS, 1> f_table;
+	typedef mode_table<two_quad<'~'>, AM_ALL, AM_LVALS, 1> not_table;
+	typedef mode_table<two_quad<'n'>, AM_ALL, AM_LVALS, 1> n_table;
+	typedef mode_table<two_quad<'N'>, AM_FLOATS, AM_LVALS, 1> fn_table;
+	typedef mode_table<call_quad, AM_ALL, 1, 1> c_table;
+	typedef mode_table<push_quad<'p'>, AM_ALL, 1, 1> p_table;
+	typedef mode_table<push_quad<'P'>, AM_FLOATS, 1, 1> fp_table;
+
+	const int m1 = mode ( q.op1() );
+	const int m2 = mode ( q.op2() );
+	const int m3 = mode ( q.op3() );
+	handler_type h = 0;
+
+	switch ( q.op() )
+	{
+	case 'a': { static const a_table t; h = t ( m1, m2, m3 ); } break;
+	case 's': { static const s_table t; h = t ( m1, m2, m3 ); } break;
+	case 'm': { static const m_table t; h = t ( m1, m2, m3 ); } break;
+	case 'd': { static const d_table t; h = t ( m1, m2, m3 ); } break;
+	case 'r': { static const r_table t; h = t ( m1, m2, m3 ); } break;
+	case '|': { static const or_table t; h = t ( m1, m2, m3 ); } break;
+	case '&': { static const and_table t; h = t ( m1, m2, m3 ); } break;
+	case 'A': { static const fa_table t; h = t ( m1, m2, m3 ); } break;
+	case 'S': { static const fs_table t; h = t ( m1, m2, m3 ); } break;
+	case 'M': { static const fm_table t; h = t ( m1, m2, m3 ); } break;
+	case 'D': { static const fd_table t; h = t ( m1, m2, m3 ); } break;
+	case 'l': { static const l_table t; h = t ( m1, m2 ); } break;
+	case 'g': { static const g_table t; h = t ( m1, m2 ); } break;
+	case 'e': { static const e_table t; h = t ( m1, m2 ); } break;
+	case 'L': { static const fl_table t; h = t ( m1, m2 ); } break;
+	case 'G': { static const fg_table t; h = t ( m1, m2 ); } break;
+	case 'E': { static const fe_table t; h = t ( m1, m2 ); } break;
+	case 'i': { static const i_table t; h = t ( m1, m2 ); } break;
+	case 'I': { static const fi_table t; h = t ( m1, m2 ); } break;
+	case '=': { static const eq_table t; h = t ( m1, m2 ); } break;
+	case 'F': { static const ff_table t; h = t ( m1, m2 ); } break;
+	case 'f': { static const f_table t; h = t ( m1, m2 ); } break;
+	case '~': { static const not_table t; h = t ( m1, m2 ); } break;
+	case 'n': { static const n_table t; h = t ( m1, m2 ); } break;
+	case 'N': { static const fn_table t; h = t ( m1, m2 ); } break;
+	case 'c':
+		switch ( q.op2().val.s )
+		{
+		case -1: return exec_pseudo<-1>;
+		case -2: return exec_pseudo<-2>;
+		case -3: return exec_pseudo<-3>;
+		case -4: return exec_pseudo<-4>;
+		case -5: return exec_pseudo<-5>;
+		case -9: return exec_pseudo<-9>;
+		case -10: return exec_pseudo<-10>;
+		case -11: return exec_pseudo<-11>;
+		case -12: return exec_pseudo<-12>;
+		case -13: return exec_pseudo<-13>;
+		}
+		if ( q.op2().val.s < 0 ) return exec_badpseudo;
+		{ static const c_table t; h = t ( m1 ); }
+		break;
+	case 'p': { static const p_table t; h = t ( m1 ); } break;
+	case 'P': { static const fp_table t; h = t ( m1 ); } break;
+	case '$': return exec_start;
+	case 'j': return exec_jump;
+	case '#': return exec_link;
+	case '^': return exec_pop;
+	case '/': return exec_return;
+	case 'h': return exec_halt;
+	case ';': return exec_noop;
+	// Block quads, with l-values where blocks belong
+	case 'w': h = exec_block<'w'>; break;
+	case 'W': h = m1 < AM_FLOATS? exec_block<'W'>: 0; break;
+	case 'b': h = m1 < AM_LVALS? exec_block<'b'>: 0; break;
+	case 'v': h = m1 < AM_LVALS? exec_block<'v'>: 0; break;
+	case 'V': h = m1 < AM_LVALS? exec_block<'V'>: 0; break;
+	case 'u': h = m1 < AM_LVALS? exec_block<'u'>: 0; break;
+	case 'U': h = m1 < AM_LVALS? exec_block<'U'>: 0; break;
+	case 't': h = m1 < AM_LVALS? exec_block<'t'>: 0; break;
+	case 'T': h = m1 < AM_LVALS? exec_block<'T'>: 0; break;
+	default: return exec_badop;
+	}
+	if ( block_op ( q.op() ) && m3 >= AM_LVALS ) h = 0;
+
+	// Only an immediate destination (or a float immediate given where
+	// an address belongs) falls outside the tables
+	return h ? h : exec_badlval;
+}
+
+// The superinstruction handler for a sequence beginning at quad i, or 0
+// if none begins there
+inline handler_type qdecoder::superinstruction ( size_t i ) const
+{
+	typedef mode_table<io_seq<-1>, AM_ALL, 1, 1> in_int_table;
+	typedef mode_table<io_seq<-2>, AM_ALL, 1, 1> in_flt_table;
+	typedef mode_table<io_seq<-3>, AM_ALL, 1, 1> in_str_table;
+	typedef mode_table<io_seq<-9>, AM_ALL, 1, 1> out_int_table;
+	typedef mode_table<io_seq<-10>, AM_ALL, 1, 1> out_flt_table;
+	typedef mode_table<io_seq<-11>, AM_ALL, 1, 1> out_str_table;
+	typedef mode_table<index_seq, AM_ALL, AM_ALL, AM_LVALS> index_table;
+	typedef mode_table<push2_seq, AM_ALL, AM_ALL, 1> push2_table;
+	typedef mode_table<pushcall_seq, AM_ALL, AM_ALL, 1> pushcall_table;
+
+	const size_t left = m_qlist.size() - i; // quads from i on
+	const quad_type &q0 = m_qlist[i];
+	if ( left < 2 ) return 0;
+	const quad_type &q1 = m_qlist[i+1];
+
+	switch ( q0.op() )
+	{
+	case 'p':
+		if ( q1.op() == 'c' && q1.op2().val.s < 0 )
+		{
+			if ( left < 3 || m_qlist[i+2].op() != '^' ) return 0;
+			const int m = mode ( q0.op1() );
+			switch ( q1.op2().val.s )
+			{
+			case -1: { static const in_int_table t; return t ( m ); }
+			case -2: { static const in_flt_table t; return t ( m ); }
+			case -3: { static const in_str_table t; return t ( m ); }
+			case -9: { static const out_int_table t; return t ( m ); }
+			case -10: { static const out_flt_table t; return t ( m ); }
+			case -11: { static const out_str_table t; return t ( m ); }
+			}
+			return 0;
+		}
+		if ( q1.op() == 'c' )
+		{
+			static const pushcall_table t;
+			return t ( mode ( q0.op1() ), mode ( q1.op1() ) );
+		}
+		if ( q1.op() == 'p' )
+		{
+			static const push2_table t;
+			return t ( mode ( q0.op1() ), mode ( q1.op1() ) );
+		}
+		return 0;
+
+	case 'm':
+		if ( q1.op() == 'a' && mode ( q0.op2() ) == AM_IMM
+			&& same ( q1.op2(), q0.op3() ) && same ( q1.op3(), q0.op3() ) )
+		{
+			static const index_table t;
+			return t ( mode ( q0.op1() ), mode ( q1.op1() ),
+				mode ( q0.op3() ) );
+		}
+		return 0;
+	}
+
+	return 0;
+}
+
+// Run decoded quads, starting with st.pc (quad 0 unless it was set),
+// until a halt
+inline void run_threaded ( thread_state &st )
+{
+#ifdef TAIL_THREADED
+	st.pc->h ( st.pc, st );
+#else
+	for ( const dquad_type *ip = st.pc; ip; ip = ip->h ( ip, st ) )
+		st.pc = ip;
+#endif
+}
+
+#endif // THREADED_H
@@ -0,0 +1,328 @@
+// tracebin.h
+// Binary execution traces for the Compiler Theory Class interpreter
+
+// A qtrace records what each quad a program runs does, as an event of
+// fixed size, in a ring: a file mapped into memory that holds the last
+// so many events, so a long run can be traced to the end, and the file
+// read after it stops, however it stops.  The switch engine records the
+// events (see interp.h, --trace-bin); vmq-tracedump (tracedump.cpp)
+// renders them as the text trace that 'x' quads ask for.
+//
+// An event is begun before its quad runs, and marked done when the quad
+// has done everything the text trace shows.  A quad that stops the run
+// with an error leaves its event not done, and is rendered as the text
+// trace leaves it: the quad, with nothing after it.  A trace file is for
+// the program it was taken of, as loaded (see qsnapshot::key).
+
+#ifndef TRACEBIN_H
+#define TRACEBIN_H
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include "storage.h"
+#include "quad.h"
+#include "mapfile.h"
+
+using namespace std;
+
+#define QTRACE_MAGIC "VMQT"
+#define QTRACE_ORDER 0x0102	// reads as 0x0201 with the other byte order
+#define QTRACE_VERSION 1	// change when the layout changes
+#define QTRACE_DEFAULT 0x100000	// events a ring holds, unless asked
+
+struct qtrace_header
+{
+	char magic[4];		// QTRACE_MAGIC
+	unsigned short order;	// QTRACE_ORDER
+	unsigned short version;	// QTRACE_VERSION
+	unsigned long long key;	// of the program (qsnapshot::key)
+	unsigned int memsize;	// size of its data memory
+	unsigned int width;	// sizeof(adr_type)
+	unsigned long long capacity;	// events the ring holds
+	unsigned long long count;	// events recorded; the last is
+					// at (count - 1) % capacity
+};
+
+struct qtrace_event
+{
+	unsigned int pc;	// the quad
+	unsigned char done;	// it did all the trace shows
+	unsigned char taken;	// a branch was taken
+	unsigned char words;	// 'p': words of stack shown, +0x80 for "..."
+	unsigned char pad;
+	unsigned int adr;	// result address, new pc or stack top
+	unsigned char value[4];	// the raw result, the word at the top, or
+					// the bytes of a block
+	unsigned char stack[16];	// 'p': the top of the stack
+};
+
+class qtrace
+{
+public:
+	qtrace ( void ): m_head(0), m_ring(0), m_ev(0), m_next(0),
+		m_capacity(0), m_mapped(false) {}
+	~qtrace () { close(); }
+
+	// Make the file, for a ring of capacity events; false, with errno
+	// set, if it can't be made
+	bool create ( const char *fname, size_t capacity,
+		unsigned long long key, size_t memsize );
+	// Write out what isn't in the file yet; false, with errno set, if
+	// it can't be
+	bool close ( void );
+
+	// Begin the event of quad pc, then note what it did
+	void begin ( size_t pc )
+	{
+		m_ev = m_ring + m_next;
+		if ( ++m_next == m_capacity ) m_next = 0;
+		memset ( m_ev, 0, sizeof(*m_ev) );
+		m_ev->pc = pc;
+		++m_head->count;
+	}
+	void result ( const storage_type &mem, adr_type adr, size_t width )
+	{
+		m_ev->adr = adr;
+		memcpy ( m_ev->value, mem.Image() + adr, width );
+	}
+	void branch ( bool taken, size_t pc )
+		{ m_ev->taken = taken; m_ev->adr = pc; }
+	void jump ( size_t pc ) { m_ev->adr = pc; }
+	void stack ( const storage_type &mem );
+	void top ( const storage_type &mem )
+	{
+		adr_type a = mem.Adr ( mem.STop() );
+		m_ev->adr = mem.STop();
+		memcpy ( m_ev->value, &a, sizeof(a) );
+	}
+	// The block a block quad wrote (block.h)
+	void block ( adr_type adr, size_t bytes )
+	{
+		const unsigned int n = bytes;
+		m_ev->adr = adr;
+		memcpy ( m_ev->value, &n, sizeof(n) );
+	}
+	void done ( void ) { m_ev->done = 1; }
+
+	// Render an event of the program as text, as the text trace shows
+	// its quad
+	static void render ( ostream &os, const quad_list &qlist,
+		const qtrace_event &ev );
+
+private:
+	qtrace ( const qtrace & );	// not copied
+	void operator = ( const qtrace & );
+
+	qtrace_header *m_head;
+	qtrace_event *m_ring;
+	qtrace_event *m_ev;	// being recorded
+	size_t m_next;		// the event to record next
+	size_t m_capacity;
+	bool m_mapped;		// the file is mapped, not in m_buf
+	string m_fname;
+	vector<char> m_buf;
+};
+
+inline bool qtrace::create ( const char *fname, size_t capacity,
+	unsigned long long key, size_t memsize )
+{
+	close();
+	const size_t size = sizeof(qtrace_header)
+		+ capacity * sizeof(qtrace_event);
+	char *p = 0;
+#ifdef HAVE_MMAP
+	const int fd = ::open ( fname, O_RDWR | O_CREAT | O_TRUNC, 0666 );
+	if ( fd < 0 ) return false;
+	if ( ftruncate ( fd, size ) == 0 )
+	{
+		void *m = mmap ( 0, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, 0 );
+		if ( m != MAP_FAILED ) p = (char *)m, m_mapped = true;
+	}
+	const int e = errno;
+	::close ( fd );
+	if ( !p )
+	{
+		errno = e;
+		return false;
+	}
+#else
+	// Kept in memory, and written at close
+	ofstream os ( fname, ios::out | ios::binary | ios::trunc );
+	if ( !os ) return false;
+	m_buf.assign ( size, 0 );
+	p = &m_buf[0];
+#endif
+	m_fname = fname;
+	m_head = (qtrace_header *)p;
+	m_ring = (qtrace_event *)(p + sizeof(qtrace_header));
+	memset ( m_head, 0, sizeof(*m_head) );
+	memcpy ( m_head->magic, QTRACE_MAGIC, sizeof(m_head->magic) );
+	m_head->order = QTRACE_ORDER;
+	m_head->version = QTRACE_VERSION;
+	m_head->key = key;
+	m_head->memsize = memsize;
+	m_head->width = sizeof(adr_type);
+	m_head->capacity = capacity;
+	m_capacity = capacity;
+	m_next = 0;
+	return true;
+}
+
+inline bool qtrace::close ( void )
+{
+	if ( !m_head ) return true;
+	const size_t size = sizeof(qtrace_header)
+		+ m_capacity * sizeof(qtrace_event);
+	bool ok = true;
+#ifdef HAVE_MMAP
+	if ( m_mapped ) munmap ( (void *)m_head, size );
+#endif
+	if ( !m_mapped )
+	{
+		ofstream os ( m_fname.c_str(), ios::out | ios::binary | ios::trunc );
+		os.write ( (const char *)m_head, size );
+		os.close();
+		ok = bool ( os );
+	}
+	m_head = 0;
+	m_ring = m_ev = 0;
+	m_mapped = false;
+	vector<char>().swap ( m_buf );
+	return ok;
+}
+
+// As the text trace shows the stack after a push: the words from the top
+// to the dynamic link, no more than 16 bytes of them
+inline void qtrace::stack ( const storage_type &mem )
+{
+	adr_type i;
+	int n = 0;
+	for ( i = mem.STop(); i <= mem.DLink() && i < mem.STop()+16;
+		i += sizeof(adr_type) )
+	{
+		const adr_type a = mem.Adr(i);
+		memcpy ( m_ev->stack + n * sizeof(a), &a, sizeof(a) );
+		++n;
+	}
+	m_ev->words = n | (i <= mem.DLink()? 0x80: 0);
+	m_ev->adr = mem.STop();
+}
+
+inline void qtrace::render ( ostream &os, const quad_list &qlist,
+	const qtrace_event &ev )
+{
+	const quad_type &q = qlist[ev.pc];
+	os << setw(4) << ev.pc << ": " << q;
+	const char op = q.op();
+	if ( !ev.done )
+	{
+		os << endl;
+		return;
+	}
+
+	const ios::fmtflags fmt = os.flags();
+	const int oldfill = os.fill('0');
+	char type = 0;	// of a result in memory
+	switch ( op )
+	{
+	case 'a': case 's': case 'm': case 'd': case 'r': case '|': case '&':
+	case 'i': case 'f': case '~': case 'n':
+		type = 's';
+		break;
+	case 'A': case 'S': case 'M': case 'D': case 'I': case 'F': case 'N':
+		type = 'f';
+		break;
+	case '=':
+		type = 'c';
+		break;
+	case 'l': case 'L': case 'g': case 'G': case 'e': case 'E':
+		if ( ev.taken ) os << " --> branch to " << ev.adr;
+		else os << " --> branch not taken";
+		break;
+	case 'c':
+		os << " --> Call function at " << label_type ( ev.adr );
+		break;
+	case 'p': case 'P':
+		os.setf(ios::hex, ios::basefield);
+		os.setf(ios::internal, ios::adjustfield);
+		os << " --> stack now";
+		for ( int k = 0; k < (ev.words & 0x7f); ++k )
+		{
+			adr_type a;
+			memcpy ( &a, ev.stack + k * sizeof(a), sizeof(a) );
+			os << " " << setw(4) << a;
+		}
+		if ( ev.words & 0x80 ) os << "...";
+		break;
+	case '^':
+		{
+			adr_type a;
+			memcpy ( &a, ev.value, sizeof(a) );
+			os.setf(ios::hex, ios::basefield);
+			os.setf(ios::internal, ios::adjustfield);
+			os.setf(ios::showbase);
+			os << "  --> Stack Top (" << setw(6) << adr_type ( ev.adr )
+				<< ") = " << setw(6) << a;
+		}
+		break;
+	case '$': case 'j': case '/':
+		os << " --> " << adr_type ( ev.adr );
+		break;
+	// As interpreter::traceblock shows it
+	case 'b': case 'w': case 'W': case 'v': case 'V': case 'u': case 'U':
+	case 't': case 'T':
+		{
+			unsigned int n;
+			memcpy ( &n, ev.value, sizeof(n) );
+			os.setf(ios::showbase);
+			os.setf(ios::internal, ios::adjustfield);
+			os << hex << " --> (" << setw(6) << adr_type ( ev.adr ) << ") "
+				<< dec << n << " bytes";
+		}
+		break;
+	}
+
+	// As interpreter::traceresult shows it
+	if ( type )
+	{
+		os.setf(ios::showbase);
+		os.setf(ios::internal, ios::adjustfield);
+		os << hex;
+		os << " --> (" << setw(6) << adr_type ( ev.adr ) << ") = ";
+		switch ( type )
+		{
+		case 's':
+			{
+				word_type v;
+				memcpy ( &v, ev.value, sizeof(v) );
+				os << setw(6) << v << dec << " ( = " << v << " )";
+			}
+			break;
+		case 'c':
+			{
+				const char c = ev.value[0];
+				os << (unsigned short) c;
+				if ( isprint ( c ) ) os << " ( = " << c << " )";
+			}
+			break;
+		case 'f':
+			{
+				float f;
+				memcpy ( &f, ev.value, sizeof(f) );
+				os << f;
+			}
+			break;
+		}
+	}
+	os.fill(oldfill);
+	os.flags ( fmt );
+	os << endl;
+}
+
+#endif // TRACEBIN_H
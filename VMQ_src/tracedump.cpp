@@ -0,0 +1,131 @@
+// tracedump.cpp
+// Render a binary execution trace of the Virtual Quadruple Machine
+
+// vmq-tracedump reads a trace file written by vmq --trace-bin, and the
+// quad file of the program traced, and writes the events the file holds,
+// oldest first, as the text trace of the program would show them (see
+// tracebin.h).  With -n, it writes only the last so many.
+
+#define VERSION "2.04"	// as vmq.cpp
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+#include "storage.h"
+#include "quad.h"
+#include "output.h"
+#include "input.h"
+#include "qobject.h"
+#include "mapfile.h"
+#include "loader.h"
+#include "snapshot.h"
+#include "tracebin.h"
+
+using namespace std;
+
+// Output written by the program, and input it reads (none, here)
+thread_local out_buffer qout;
+thread_local in_scanner qin;
+
+static void usage ( const char *prog )
+{
+	cerr << "Usage: " << prog << " [-n <events>] <tracefile> <quadfile>"
+		<< endl;
+	exit ( 10 );
+}
+
+int main ( int argc, char *argv[] )
+{
+	const char *tname = 0, *qfname = 0;
+	unsigned long long last = 0;	// events to write, if not all
+	for ( int i = 1; i < argc; ++i )
+	{
+		if ( strcmp ( argv[i], "-n" ) == 0 && i + 1 < argc
+			&& atoll ( argv[i+1] ) > 0 )
+			last = atoll ( argv[++i] );
+		else if ( argv[i][0] == '-' || qfname )
+			usage ( argv[0] );
+		else if ( !tname )
+			tname = argv[i];
+		else
+			qfname = argv[i];
+	}
+	if ( !qfname ) usage ( argv[0] );
+
+	mapped_file tf;
+	if ( !tf.open ( tname ) )
+	{
+		cerr << "Can't open file " << tname << ": " << strerror(errno)
+			<< endl;
+		return 10;
+	}
+	qtrace_header h;
+	if ( tf.size() < sizeof(h) )
+	{
+		cerr << tname << " is not a trace file" << endl;
+		return 10;
+	}
+	memcpy ( &h, tf.data(), sizeof(h) );
+	if ( memcmp ( h.magic, QTRACE_MAGIC, sizeof(h.magic) ) != 0
+		|| h.order != QTRACE_ORDER || h.version != QTRACE_VERSION
+		|| h.width != sizeof(adr_type) || h.memsize == 0
+		|| h.memsize > MEM_MAX || h.capacity == 0
+		|| tf.size() != sizeof(h) + h.capacity * sizeof(qtrace_event) )
+	{
+		cerr << tname << " is not a trace file of this version" << endl;
+		return 10;
+	}
+
+	// The program, loaded as vmq loads it
+	storage_type mem ( h.memsize );
+	quad_list qlist;
+	mapped_file qf;
+	if ( !qf.open ( qfname ) )
+	{
+		cerr << "Can't open file " << qfname << ": " << strerror(errno)
+			<< endl;
+		return 10;
+	}
+	mapped_file cache;
+	qbreader reader ( mem, qlist );
+	if ( !( reader.go ( qf.data(), qf.size() )
+		|| ( cache.open ( qobj_cachename ( qfname ).c_str() )
+			&& reader.go ( cache.data(), cache.size(),
+				qf.data(), qf.size() ) ) ) )
+	{
+		qfreader loader ( qf.data(), qf.size(), mem, qlist );
+		if ( loader.go() > ERR_WARN )
+		{
+			cerr << "Can't load " << qfname << endl;
+			return 10;
+		}
+	}
+	if ( qsnapshot::key ( qlist, mem ) != h.key )
+	{
+		cerr << tname << " is not a trace of " << qfname << endl;
+		return 10;
+	}
+
+	// The events in the ring, oldest first
+	const qtrace_event *ring =
+		(const qtrace_event *)(tf.data() + sizeof(h));
+	unsigned long long n = h.count < h.capacity? h.count: h.capacity;
+	if ( last && last < n ) n = last;
+	cerr << h.count << " events recorded; the last " << n << ":" << endl;
+	for ( unsigned long long i = h.count - n; i < h.count; ++i )
+	{
+		const qtrace_event &ev = ring[i % h.capacity];
+		if ( ev.pc >= qlist.size() )
+		{
+			cerr << tname << ": event of quad " << ev.pc
+				<< ", not in the program" << endl;
+			return 10;
+		}
+		qtrace::render ( cout, qlist, ev );
+	}
+	return 0;
+}
@@ -0,0 +1,217 @@
+// verify.h
+// Load-time verification of quad programs for the Compiler Theory Class
+// interpreter
+
+// The threaded engine (threaded.h) reads and writes absolute and
+// base-relative operands, and the runtime stack, without checking their
+// alignment.  That is safe for a program in which
+//   - every label of a j, l/g/e, L/G/E or c quad names a quad of the
+//     program, and a negative c label names one of the I/O functions;
+//   - every absolute operand wider than a byte, and every pointer an
+//     indirect operand goes through, lies in data memory at an even
+//     address;
+//   - every base-relative offset is even, because the dynamic link and
+//     the stack top stay even while every frame size (#) and pop (^) is
+//     even;
+//   - immediate operands have the type the operation calls for, and no
+//     destination is immediate.
+// Addresses computed at run time (indirect operands) are still checked.
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <iostream>
+#include <vector>
+#include <cctype>
+#include <string>
+#include "storage.h"
+#include "quad.h"
+
+using namespace std;
+
+class qverifier
+{
+public:
+	qverifier ( const quad_list &qlist, const storage_type &mem,
+		ostream &err = cerr )
+		: m_qlist(qlist), m_mem(mem), m_err(err), m_cur(0), m_ok(true) {}
+	bool go ( void ); // true if the program passed
+
+private:
+	void operand ( const qop &q, char type, bool dst );
+	void label ( const qop &q );
+	void even ( const qop &q, const char *what );
+	void posterror ( const string &msg );
+
+	const quad_list &m_qlist;
+	const storage_type &m_mem;
+	ostream &m_err;
+	size_t m_cur; // quad being checked
+	bool m_ok;
+};
+
+inline bool qverifier::go ( void )
+{
+	const bool f = false, t = true; // notational convenience
+
+	for ( m_cur = 0; m_cur < m_qlist.size(); ++m_cur )
+	{
+		const quad_type &q = m_qlist[m_cur];
+		const char r = isupper ( q.op() ) ? 'f' : 's'; // operand type
+
+		switch ( q.op() )
+		{
+		// 3 address quads
+		case 'a': case 'A': case 's': case 'S': case 'm': case 'M':
+		case 'd': case 'D': case 'r': case '|': case '&':
+			operand ( q.op1(), r, f );
+			operand ( q.op2(), r, f );
+			operand ( q.op3(), r, t );
+			break;
+		case 'l': case 'L': case 'g': case 'G': case 'e': case 'E':
+			operand ( q.op1(), r, f );
+			operand ( q.op2(), r, f );
+			label ( q.op3() );
+			break;
+		// Block and vector quads: the blocks' first elements; the rest are
+		// checked as the quad runs
+		case 'b':
+			operand ( q.op1(), 'c', t );
+			operand ( q.op2(), 's', f );
+			operand ( q.op3(), 'c', t );
+			break;
+		case 'w': case 'W':
+			operand ( q.op1(), r, f );
+			operand ( q.op2(), 's', f );
+			operand ( q.op3(), r, t );
+			break;
+		case 'v': case 'V': case 'u': case 'U': case 't': case 'T':
+			operand ( q.op1(), r, t );
+			operand ( q.op2(), 's', f );
+			operand ( q.op3(), r, t );
+			break;
+		// 2 address quads
+		case 'i': case 'I': case '~': case 'n': case 'N':
+			operand ( q.op1(), r, f );
+			operand ( q.op2(), r, t );
+			break;
+		case '=':
+			operand ( q.op1(), 'c', f );
+			operand ( q.op2(), 'c', t );
+			break;
+		case 'F':
+			operand ( q.op1(), 's', f );
+			operand ( q.op2(), 'f', t );
+			break;
+		case 'f':
+			operand ( q.op1(), 'f', f );
+			operand ( q.op2(), 's', t );
+			break;
+		// Function call: pseudo-calls do not use the result address
+		case 'c':
+			label ( q.op2() );
+			if ( q.op2().val.s >= 0 ) operand ( q.op1(), 'a', f );
+			break;
+		// 1 address quads
+		case 'p':
+			operand ( q.op1(), 'a', f );
+			break;
+		case 'P':
+			operand ( q.op1(), 'f', f );
+			break;
+		// Labels and sizes
+		case '$': case 'j':
+			label ( q.op1() );
+			break;
+		case '#':
+			even ( q.op1(), "Stack frame size" );
+			break;
+		case '^':
+			even ( q.op1(), "Number of bytes to pop" );
+			break;
+		} // end switch
+	}
+
+	return m_ok;
+}
+
+// Check an operand used as a value of the given type ('s' int, 'a'
+// address, 'f' float or 'c' char); dst is true for a destination.
+inline void qverifier::operand ( const qop &q, char type, bool dst )
+{
+	const size_t width = type == 'c'? 1: type == 'f'? 4: sizeof(adr_type);
+
+	switch ( q.adrmode )
+	{
+	case '#': case 'M':
+		if ( dst )
+			posterror ( "Destination operand cannot be immediate" );
+		else if ( type == 'f' && q.vtype != 'f' )
+			posterror ( "Instruction requires float operand" );
+		else if ( type != 'f' && q.vtype == 'f' )
+			posterror ( "Instruction requires int operand" );
+		break;
+	case ' ':
+		if ( width > 1 && (q.val.a & 1) )
+			posterror ( "Unaligned operand address" );
+		else if ( q.val.a + width > m_mem.Size() )
+			posterror ( "Operand address outside data memory" );
+		break;
+	case '@':
+		if ( q.val.a & 1 )
+			posterror ( "Unaligned pointer address" );
+		else if ( q.val.a + sizeof(adr_type) > m_mem.Size() )
+			posterror ( "Pointer address outside data memory" );
+		break;
+	case '_':
+		if ( width > 1 && (q.val.s & 1) )
+			posterror ( "Odd base-relative offset" );
+		break;
+	case 'N':
+		if ( q.val.s & 1 )
+			posterror ( "Odd base-relative offset" );
+		break;
+	}
+}
+
+// Check a label: a quad number, or one of the pseudo-call numbers
+inline void qverifier::label ( const qop &q )
+{
+	const label_type n = q.val.s;
+
+	if ( n >= 0 )
+	{
+		if ( size_t(n) >= m_qlist.size() )
+			posterror ( "Label outside the quad list" );
+		return;
+	}
+	if ( m_qlist[m_cur].op() == 'c' )
+	{
+		switch ( n )
+		{
+		case -1: case -2: case -3: case -4: case -5:
+		case -9: case -10: case -11: case -12: case -13: return;
+		}
+		posterror ( "Unrecognized pseudo-quad number" );
+		return;
+	}
+	posterror ( "Label outside the quad list" );
+}
+
+// Check a size that keeps the stack top even
+inline void qverifier::even ( const qop &q, const char *what )
+{
+	if ( q.val.s < 0 || (q.val.s & 1) )
+		posterror ( string ( what ) + " must be even and not negative" );
+}
+
+// Post a verification failure, always at warning level: the program
+// still runs, on the fully checked switch engine.
+inline void qverifier::posterror ( const string &msg )
+{
+	m_err << "quad " << m_cur << ": " << m_qlist[m_cur] << endl;
+	m_err << "Warning: " << msg << endl;
+	m_ok = false;
+}
+
+#endif // VERIFY_H
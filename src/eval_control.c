@@ -3,6 +3,10 @@
 
 void evalControl(struct AST_node *a)
 {
+	// A loop that only streams an array in or out is one array I/O call (eval_stream.c).
+	if (a->nodetype == WHILE && evalStreamLoop(a))
+		return;
+
 	struct AST_node *cond_code = ((struct ctrl_node *)a)->c;
 	struct AST_node *true_code = ((struct ctrl_node *)a)->t;
 	struct AST_node *false_code = ((struct ctrl_node *)a)->f;
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include "eval.h"
+
+// A while loop that does nothing but stream an array in or out, one element per pass:
+//
+//	while (i < n) { cin >> a[i]; i += 1; }
+//	while (i < n) { cout << a[i] << " "; i = i + 1; }
+//
+// is generated as a single array I/O pseudo-call (-4/-5 read, -12/-13 write) for the
+// elements a[i] through a[n-1], instead of a call per element.  The string after a[i],
+// if any, is written after each element.  n is an int literal or an int variable.
+
+// Returns the int scalar accessed by node a, or NULL if a isn't one.  Parameters are
+// passed by reference, so they could name an element of the array; they aren't taken.
+static struct var *streamScalar(struct AST_node *a)
+{
+	if (!a || a->nodetype != VAR_ACCESS)
+		return NULL;
+
+	struct var *v = ((struct var_node *)a)->val;
+	if (v->var_type != INT || v->size > 1 || v->isParam)
+		return NULL;
+
+	return v;
+}
+
+static int isLiteralOne(struct AST_node *a)
+{
+	return a && a->nodetype == INT_LITERAL && atoi(((struct int_node *)a)->val->val) == 1;
+}
+
+static int isVarAccess(struct AST_node *a, struct var *v)
+{
+	return a && a->nodetype == VAR_ACCESS && ((struct var_node *)a)->val == v;
+}
+
+// Is statement s "i += 1;", "i = i + 1;" or "i = 1 + i;"?
+static int isIncrement(struct AST_node *s, struct var *i)
+{
+	if (!s || s->nodetype != STMT || !s->l)
+		return 0;
+
+	struct AST_node *e = s->l;
+	if (e->nodetype == ADD_ASSIGN)
+		return isVarAccess(e->l, i) && isLiteralOne(e->r);
+
+	if (e->nodetype == ASSIGNOP && isVarAccess(e->l, i) && e->r->nodetype == ADD && e->r->r)
+		return (isVarAccess(e->r->l, i) && isLiteralOne(e->r->r)) ||
+		       (isLiteralOne(e->r->l) && isVarAccess(e->r->r, i));
+
+	return 0;
+}
+
+int evalStreamLoop(struct AST_node *a)
+{
+	struct AST_node *cond_code = ((struct ctrl_node *)a)->c;
+	struct AST_node *true_code = ((struct ctrl_node *)a)->t;
+
+	// Condition:  i < n
+	if (cond_code->nodetype != LT)
+		return 0;
+
+	struct AST_node *bound = ((struct relop_node *)cond_code)->r;
+	struct var *i = streamScalar(((struct relop_node *)cond_code)->l);
+	struct var *n = streamScalar(bound);
+
+	if (!i || (bound->nodetype != INT_LITERAL && (!n || n == i)))
+		return 0;
+
+	// Body:  { <stream statement>; <increment of i>; }
+	if (true_code->nodetype != STMT || !true_code->l || true_code->l->nodetype != STMTS)
+		return 0;
+
+	struct AST_node *stmts = true_code->l;
+	if (!stmts->l || stmts->l->nodetype != STMTS || !stmts->l->l || stmts->l->l->nodetype != 0)
+		return 0;
+
+	struct AST_node *io = stmts->l->r, *item = NULL, *sep = NULL;
+	if (!isIncrement(stmts->r, i))
+		return 0;
+
+	// The stream statement:  cin >> a[i]  or  cout << a[i] [<< string]
+	if (io->nodetype == INPUT)
+	{
+		item = io->l;
+		if (!item || item->nodetype != STREAMIN)
+			return 0;
+	}
+	else if (io->nodetype == OUTPUT)
+	{
+		item = io->l;
+		if (item && item->nodetype == STREAMOUT && item->r &&
+		    (item->r->nodetype == STR_LITERAL || item->r->nodetype == ENDL))
+		{
+			sep = item->r;
+			item = item->l;
+		}
+
+		if (!item || item->nodetype != STREAMOUT)
+			return 0;
+	}
+	else
+		return 0;
+
+	if (!item->l || item->l->nodetype != 0)
+		return 0;
+
+	struct AST_node *elem = item->r;
+	if (!elem || elem->nodetype != ARR_ACCESS || !isVarAccess(elem->r, i))
+		return 0;
+
+	// A parameter array is the caller's, and could be one that holds i or n;
+	// reading into it must not change them.
+	struct var *arr = ((struct var_node *)elem->l)->val;
+	if (io->nodetype == INPUT && arr->isParam && (i->isGlobal || (n && n->isGlobal)))
+		return 0;
+
+	// Generate the call.
+	struct func_list_node *func = CURRENT_FUNC;
+	struct VMQ_temp_node *result = &func->VMQ_data.math_result;
+	unsigned int orig_size = func->VMQ_data.tempvar_cur_size;
+
+	char *i_mode = i->isGlobal ? "" : "/-";
+	char n_str[16];
+
+	if (n)
+		sprintf(n_str, "%s%d", n->isGlobal ? "" : "/-", n->VMQ_loc);
+	else
+		sprintf(n_str, "%d", ((struct int_node *)bound)->val->VMQ_loc);
+
+	// Number of elements:  n - i
+	unsigned int count = getNewTempVar(INT);
+	sprintf(VMQ_line, "s %s %s%d /-%d", n_str, i_mode, i->VMQ_loc, count);
+	appendToVMQList(VMQ_line);
+
+	// Without a string to write after each element, write an empty one.
+	unsigned int blank = 0;
+	if (io->nodetype == OUTPUT && !sep)
+	{
+		blank = getNewTempVar(INT);
+		sprintf(VMQ_line, "i #0 /-%d", blank);
+		appendToVMQList(VMQ_line);
+	}
+
+	// Address of a[i]
+	evalArrAccess(elem);
+
+	if (io->nodetype == OUTPUT)
+	{
+		if (sep)
+			sprintf(VMQ_line, "p #%d", ((struct str_node *)sep)->val->VMQ_loc);
+		else
+			sprintf(VMQ_line, "p #/-%d", blank);
+		appendToVMQList(VMQ_line);
+	}
+
+	sprintf(VMQ_line, "p /-%d", count);
+	appendToVMQList(VMQ_line);
+	sprintf(VMQ_line, "p /-%d", result->VMQ_loc);
+	appendToVMQList(VMQ_line);
+
+	if (io->nodetype == INPUT)
+	{
+		appendToVMQList(arr->var_type == INT ? "c 0 -4" : "c 0 -5");
+		appendToVMQList("^ 4");
+	}
+	else
+	{
+		appendToVMQList(arr->var_type == INT ? "c 0 -12" : "c 0 -13");
+		appendToVMQList("^ 6");
+	}
+
+	// The loop leaves i at n, if it ran at all.
+	sprintf(VMQ_line, "l /-%d #1 %d", count, func->VMQ_data.quad_end_line + 3);
+	appendToVMQList(VMQ_line);
+	sprintf(VMQ_line, "i %s %s%d", n_str, i_mode, i->VMQ_loc);
+	appendToVMQList(VMQ_line);
+
+	while (func->VMQ_data.tempvar_cur_size != orig_size)
+		freeTempVar();
+
+	return 1;
+}